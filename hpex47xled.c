@@ -48,6 +48,65 @@
 /////  - added --audit and -a to command line arguments. This will allow me to see if the changes to led state are working. Might be useful for other statistics later
 /////  - changed version to 1.0.5 to account for these minor modifications.
 /////
+/////  - 2026-10-19
+/////  - replaced the switch ladders in blt/rlt/plt/offled with a led_mask[bay][color] table generated from a board description
+/////  - board is picked at build time with BOARD= in the Makefile (EX470 default, EX475). EX485/EX487 are refused - different LED hardware
+/////  - the generated masks are checked against BL1-4/RL1-4/PL1-4 with _Static_assert so a bad description will not compile
+/////  - an unknown or missing BOARD is an #error rather than quietly building the EX470 tables
+/////  - only the EX470 description is checked against BL1-4/RL1-4/PL1-4. every board is checked for its own sanity - bays within
+/////    the table, bits within the register, blue and red on different bits - so a variant with another bit map still builds
+/////
+/////  - 2026-10-19
+/////  - idle mode: after IDLE_SWEEPS quiet passes the per bay delays are replaced by one wait per pass that doubles up to IDLE_MAX_DELAY
+/////  - idle waits poll() the devd socket so a hotswap wakes us early, plain nanosleep() if devd is not running
+/////  - wakeup/snapshot counters and cpu time are logged on SIGUSR1 (SIGINFO) and at shutdown
+/////
+/////  - 2026-10-19
+/////  - devstat errors no longer err(1) - main() is a supervisor that backs off (BACKOFF_MIN to BACKOFF_MAX) and re-initializes
+/////  - a bay whose counters can't be read is quarantined with its own backoff and picked up again when it recovers
+/////  - unknown path_id/target_id or more than BAYS devices are logged and skipped. hpex470[] is filled in bay order, not by di
+/////  - --fault N swaps in a stats backend that fails 1 in N calls so the recovery paths can be exercised
+/////  - error counters added to the SIGUSR1 stats
+/////  - bay positions CAM reports while we are root are kept in bay_dev[] - re-init after drop_priviledges() can't open CAM as nobody
+/////    (replaced below - a name tells nothing about the bay, CAM hands a freed unit number to whatever disk comes next)
+/////  - quarantined bays take their LED_DELAY like quiet ones so an all quarantined box doesn't spin on snapshots
+/////  - the supervisor is supervise(). main() keeps root until an init has placed the bays, then drops and supervises for good
+/////  - after a devstat outage the first pass takes the counters as they are, like a bay back from quarantine
+/////  - a re-init after a device change keeps the baselines of the disks that stayed so their work in between still shows
+/////  - --simulate drives supervise() too - devstat faults, outages, stale device lists and a disk that can't be read, with CAM
+/////    gone after the first init - and checks backoff and quarantine bounds, dark lights while backing off and full recovery
+/////  - a forked CAM locator keeps root and answers where a disk sits, so re-init as nobody asks CAM every time like the first init.
+/////    bay_dev[] is gone - a disk swapped into another bay under the same name, or added to an empty bay, is placed where it is.
+/////    if the locator is gone a disk is logged as unplaced, never guessed. --simulate moves and adds disks at device changes
+/////
+/////  - 2026-10-19
+/////  - --status prints the bay map, throughput, IOPS and LED state from the running daemon over STATUS_SOCK - no second devstat poll
+/////  - --sample N runs the same monitor loop for N seconds with a dry run LED sink and prints what it saw and decided. no root needed
+/////  - LED register access goes through struct ledsink (port or dry run) like the stats go through struct statsrc
+/////  - --sample without root shows the slot as ? rather than numbering devices in devstat order - CAM is the only source for the bay
+/////  - a bay with no slot (HDD 0) still gets its LED decisions counted but no register writes - they changed nothing
+/////  - --sample runs under supervise() like the daemon - a devstat failure or device change backs off or re-initializes instead of
+/////    ending the sample, so --fault works with it. a backoff is cut short at the end of the sample
+/////
+/////  - 2026-10-19
+/////  - time goes through struct hpclock so run_mediasmart() can be driven by simulated time
+/////  - --simulate N runs the monitor loop over N randomized activity sequences with simulated stats, clock and register and checks
+/////    that every light comes on within SIM_MAX_ON of its disk starting work, goes out within SIM_MAX_LIT of it going quiet and
+/////    that no register write repeats the current value. built only with -DHPEX_SIMULATE - 'make test' builds and runs it
+/////  - --simulate checks the colour too - a light must come on blue if its disk wrote since the light was last on, purple if it only
+/////    read. disks whose counters a fault may have turned into a baseline are left out until their next light
+/////
+/////  - 2026-10-19
+/////  - privilege separation: a forked LED writer is the only process to open /dev/io. it drops to nobody and enters capability mode,
+/////    then applies register images sent over a seqpacket socketpair. the monitor queues changes and flushes at most one image per sleep
+/////  - the monitor limits the rights on its channel, devd and status sockets where Capsicum is available
+/////  - drop_priviledges() now errors if setgroups, setgid or setuid fails - it only caught both of the last two failing
+/////  - lights are turned off when the monitor exits, by the LED writer seeing the channel close
+/////  - the monitor reaps the LED writer on SIGCHLD and logs how it died, rather than leaving a zombie until it exits
+/////  - sigterm_handler() only sets stop_signal - the sleeps it interrupts return, the loops unwind and main() closes the LED channel
+/////    before logging and freeing. a signal landing in malloc can no longer deadlock the shutdown and leave the lights frozen
+/////  - the LED writer sends a byte once it has /dev/io and main() waits up to HELPER_TIMEOUT for it. no byte, no daemon - exit 1
+/////
 /* includes */
 #include <stdio.h>
 #include <err.h>
@@ -65,7 +124,10 @@
 #include <camlib.h>
 #include <getopt.h>
 #include <pwd.h>
+#include <grp.h>
 #include <syslog.h>
+#include <poll.h>
+#include <time.h>
 #include <machine/cpufunc.h>
 
 #include <sys/param.h>
@@ -73,6 +135,15 @@
 #include <sys/resource.h>
 #include <sys/sysctl.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#ifdef __FreeBSD__
+#include <sys/capsicum.h>
+#define HAVE_CAPSICUM 1
+#endif
 
 /* defines */
 /*
@@ -123,9 +194,31 @@
 #define HDD2   2
 #define HDD3   3
 #define HDD4   4
+#define BAYS   4
 
 #define LED_DELAY 50000000 // for nanosleep() struct timespec - blinking delay for LEDs in nanoseconds
 #define BLINK_DELAY 8500000 // for nanosleep() struct timespec - delay to cause blink for long reads and writes - in nanoseconds
+#define IDLE_SWEEPS 20 // quiet passes over all bays before going idle - about 4 seconds with 4 bays
+#define IDLE_MAX_DELAY 1000000000L // longest idle sleep in nanoseconds - worst case delay before a light comes on after idle
+#define DEVD_PIPE "/var/run/devd.seqpacket.pipe" // devd event socket - wakes us early from idle on hotswap
+#define QUARANTINE_MIN 1000 // first time out in milliseconds for a bay whose counters can't be read
+#define QUARANTINE_MAX 60000 // longest bay time out in milliseconds
+#define BACKOFF_MIN 1 // first wait in seconds after devstat fails as a whole
+#define BACKOFF_MAX 60 // longest wait in seconds between devstat retries
+#define SNAPSHOT_RETRIES 3 // failed snapshots in a row before we start over with disk_init()
+#define STATUS_SOCK "/var/run/hpex47xled.sock" // where the daemon answers --status
+#define RATE_INTERVAL 1000 // milliseconds between throughput/IOPS updates
+#define HELPER_TIMEOUT 5 // seconds the monitor waits for the LED writer to be ready or the CAM locator to answer
+#ifdef HPEX_SIMULATE
+/* --simulate: what the lights promise, in ms of simulated time from what the disk really did. requirements, not measurements */
+#define SIM_MAX_ON 1500 // a light comes on within this long of its disk starting work - idle or not
+#define SIM_MAX_LIT 2000 // and goes out within this long of the disk going quiet
+#define SIM_OPT "t:"
+#define SIM_READ 1 // sim.pend[] bits
+#define SIM_WRITE 2
+#else
+#define SIM_OPT ""
+#endif
 
 enum ledcolor {
 	BLUE = 1,
@@ -133,16 +226,101 @@ enum ledcolor {
 	PURPLE = 3,
 };
 
+/* the CAM locator's answer - where a disk sits, or why it can't say */
+struct camreply
+{
+	int rc;
+	int path_id;
+	int target_id;
+	char errbuf[256];
+};
+
+/* supervisor states in supervise() */
+enum hpstate {
+	HP_INIT = 1,
+	HP_RUN = 2,
+	HP_BACKOFF = 3,
+};
+
+/*
+ * Board descriptions - one BAY(hdd, blue bit, red bit) per drive bay, bits are positions in the LED register at ADDR.
+ * The led_mask[bay][color] table is generated from the selected board at compile time, so turning a light on or off
+ * is a single mask operation. Add a variant by writing a BOARD_xxx list and building with -DHPEX_BOARD_xxx.
+ */
+#define BOARD_EX470(BAY) \
+	BAY(1, 0, 12) \
+	BAY(2, 1, 8) \
+	BAY(3, 3, 9) \
+	BAY(4, 5, 10)
+
+/* the EX475 only ships with more disk - same board and LED register as the EX470 */
+#define BOARD_EX475(BAY) BOARD_EX470(BAY)
+
+#if defined(HPEX_BOARD_EX485) || defined(HPEX_BOARD_EX487)
+#error "The EX485/EX487 drive their bay lights from ICH9 GPIO, not the EX47x LED register - not supported by this daemon"
+#elif defined(HPEX_BOARD_EX475)
+#define BOARD_BAYS BOARD_EX475
+#define BOARD_NAME "EX475"
+#elif defined(HPEX_BOARD_EX470)
+#define BOARD_BAYS BOARD_EX470
+#define BOARD_NAME "EX470"
+#else
+#error "Unknown or missing board - build with BOARD=EX470 or BOARD=EX475 (-DHPEX_BOARD_EX470 or -DHPEX_BOARD_EX475)"
+#endif
+
+#define LED_ROWS 8 /* power of two so any bay number can be masked into the table */
+
+#define LED_ROW(hdd, blue, red) \
+	[hdd] = { [BLUE] = 1 << (blue), [RED] = 1 << (red), [PURPLE] = (1 << (blue)) | (1 << (red)) },
+
+static const u_int16_t led_mask[LED_ROWS][PURPLE + 1] = { BOARD_BAYS(LED_ROW) };
+
+/* the generated EX470 masks must match the hand written EX47x register map above. other boards have their own bit maps */
+#define LED_CHECK(hdd, blue, red) \
+	_Static_assert((1 << (blue)) == BL##hdd && (1 << (red)) == RL##hdd && ((1 << (blue)) | (1 << (red))) == PL##hdd, \
+		"EX470 bay " #hdd " does not match BL" #hdd "/RL" #hdd "/PL" #hdd);
+BOARD_EX470(LED_CHECK)
+
+/* whatever board we build for - bays 1 to LED_ROWS - 1, both bits inside the 16 bit register and not the same bit */
+#define LED_SANE(hdd, blue, red) \
+	_Static_assert((hdd) >= 1 && (hdd) < LED_ROWS && (blue) >= 0 && (blue) < 16 && (red) >= 0 && (red) < 16 && (blue) != (red), \
+		BOARD_NAME " bay " #hdd " is outside the LED table or register, or has blue and red on one bit");
+BOARD_BAYS(LED_SANE)
+
 int show_help(char * progname );
 void sigterm_handler(int s);
 size_t disk_init(void);
-size_t run_mediasmart(void);
+void disk_fini(void);
+int run_mediasmart(void);
 int blt(int bay_led);
 int rlt(int bay_led);
 int plt(int bay_led);
 int offled(int bay_led, int off_color );
 int show_version(char * progname );
 void drop_priviledges(void);
+int hp_sleep(const struct timespec *ts);
+int devd_connect(void);
+void log_stats(void);
+void stats_handler(int s);
+void chld_handler(int s);
+void leds_off(void);
+int64_t now_ms(void);
+int status_listen(void);
+void status_serve(void);
+void status_report(int fd);
+int show_status(void);
+int sample_run(size_t secs);
+void update_rates(int64_t now);
+void led_set(u_int16_t reg);
+#ifdef HPEX_SIMULATE
+int simulate(size_t sequences);
+#endif
+void led_helper(int fd);
+int helper_start(void (*helper)(int fd), pid_t *pid);
+void cam_helper(int fd);
+int cam_lookup(const char *devicename, int *path_id, int *target_id);
+void sandbox_fds(void);
+void helpers_reap(void);
 
 struct hpled
 {
@@ -157,17 +335,164 @@ struct hpled
 	int led_state;
 	int HDD;
 	char path[10];
+	u_int64_t errors;
+	int64_t q_until; /* quarantined until this now_ms() time, 0 when healthy */
+	int64_t q_delay; /* current quarantine length in milliseconds */
+	u_int64_t n_ops; /* total transfers, read and write */
+	u_int64_t r_read; /* counters at the last update_rates() */
+	u_int64_t r_write;
+	u_int64_t r_ops;
+	double rate_read; /* bytes per second over the last RATE_INTERVAL */
+	double rate_write;
+	double iops;
+	int color; /* what the light was last turned on as - BLUE or PURPLE */
+	u_int64_t lit[PURPLE + 1]; /* LED decisions - times turned on, by color */
+	u_int64_t dark; /* LED decisions - times turned off */
+};
+
+void quarantine_bay(struct hpled *bay);
+const char *slot_name(const struct hpled *bay);
+size_t bay_add(size_t disks, const char *devicename, size_t di);
+void supervise(int until_placed);
+
+/* counters for measuring what the daemon costs an idle box - logged on SIGUSR1/SIGINFO and at shutdown */
+struct hpstats
+{
+	u_int64_t wakeups;
+	u_int64_t snapshots;
+	u_int64_t idle_sleeps;
+	u_int64_t devd_events;
+	u_int64_t snapshot_errors;
+	u_int64_t init_errors;
+	u_int64_t stat_errors;
+	u_int64_t quarantines;
+	u_int64_t recoveries;
+	u_int64_t led_writes;
+	u_int64_t led_messages;
+	time_t started;
+};
+
+/* where the bays and their byte counters come from - devstat and CAM, or devstat with failures injected by --fault */
+struct statsrc
+{
+	const char *name;
+	size_t (*init)(void); /* find the bays and fill hpex470[] - the number of bays, 0 on failure */
+	int (*snapshot)(void); /* refresh cur - 0 ok, 1 device list changed, -1 error */
+	int (*counters)(size_t di, u_int64_t *b_read, u_int64_t *b_write, u_int64_t *ops); /* totals for cur.dinfo->devices[di] - 0 ok, -1 error */
+	int (*locate)(const char *devicename, int *path_id, int *target_id); /* bus position of a device - 0 ok, -1 can't tell */
+};
+
+int devstat_snapshot(void);
+int devstat_counters(size_t di, u_int64_t *b_read, u_int64_t *b_write, u_int64_t *ops);
+int cam_locate(const char *devicename, int *path_id, int *target_id);
+int fault_snapshot(void);
+int fault_counters(size_t di, u_int64_t *b_read, u_int64_t *b_write, u_int64_t *ops);
+
+const struct statsrc devstat_src = { "devstat", disk_init, devstat_snapshot, devstat_counters, cam_locate };
+const struct statsrc fault_src = { "devstat with injected faults", disk_init, fault_snapshot, fault_counters, cam_locate };
+
+/* where the LED register goes - the LED writer process, the real port (only the LED writer uses it), or nowhere for --sample */
+struct ledsink
+{
+	const char *name;
+	void (*write)(u_int16_t reg);
+	u_int16_t (*read)(void);
+	void (*flush)(void); /* called before every real sleep, NULL if writes are immediate */
 };
 
-const char *VERSION = "1.0.6";
+void port_write(u_int16_t reg);
+u_int16_t port_read(void);
+void dry_write(u_int16_t reg);
+u_int16_t dry_read(void);
+void chan_write(u_int16_t reg);
+u_int16_t chan_read(void);
+void chan_flush(void);
+
+const struct ledsink port_sink = { "/dev/io", port_write, port_read, NULL };
+const struct ledsink dry_sink = { "dry run", dry_write, dry_read, NULL };
+const struct ledsink chan_sink = { "LED writer", chan_write, chan_read, chan_flush };
+
+/* where time comes from - the monotonic clock and real sleeps, or simulated time for --simulate */
+struct hpclock
+{
+	const char *name;
+	int64_t (*now)(void); /* milliseconds */
+	int (*sleep)(const struct timespec *ts); /* 1 if woken early by devd, 0 otherwise */
+};
+
+#ifdef HPEX_SIMULATE
+int64_t sim_now(void);
+int sim_sleep(const struct timespec *ts);
+int sim_snapshot(void);
+int sim_counters(size_t di, u_int64_t *b_read, u_int64_t *b_write, u_int64_t *ops);
+void sim_write(u_int16_t reg);
+u_int16_t sim_read(void);
+void sim_advance(int64_t to);
+void sim_check(int64_t t);
+int sim_lit(int x);
+int sim_fault(void);
+void sim_move(void);
+size_t sim_init(void);
+int sim_locate(const char *devicename, int *path_id, int *target_id);
+#endif
+
+const struct hpclock real_clock = { "monotonic", now_ms, hp_sleep };
+#ifdef HPEX_SIMULATE
+const struct hpclock sim_clock = { "simulated", sim_now, sim_sleep };
+const struct statsrc sim_src = { "simulated activity", sim_init, sim_snapshot, sim_counters, sim_locate };
+const struct ledsink sim_sink = { "simulated register", sim_write, sim_read, NULL };
+
+/* --simulate: one randomized sequence of disk activity and devstat faults in simulated time, and what the LEDs did about it */
+struct hpsim
+{
+	int64_t now_ns;
+	u_int16_t reg;
+	int disks; /* simulated disks, /dev/sim0 on */
+	int hdd[BAYS]; /* the bay each disk really sits in */
+	size_t fault_rate; /* 0, or roughly one devstat call in fault_rate fails before faults_until - 1 is an outage */
+	int64_t faults_until; /* ns */
+	int sick; /* a disk whose counters fail on every read before faults_until, -1 for none */
+	int stale; /* a snapshot fault left the device list stale - snapshots fail until the next init */
+	int64_t settled; /* ns - past every backoff and quarantine the faults can cause. spells from here on must show */
+	int64_t backoff; /* ns of the last supervisor backoff, 0 after a good snapshot */
+	int64_t last_snap; /* ns of the last good snapshot - every pass takes some time, so the next one can't be at the same instant */
+	u_int64_t backoffs;
+	u_int64_t reinits;
+	u_int64_t moves; /* disks put back in another bay under the same name */
+	u_int64_t adds; /* disks added to an empty bay */
+	u_int64_t rd[BAYS];
+	u_int64_t wr[BAYS];
+	u_int64_t ops[BAYS];
+	/* the rest is indexed by disk, not by hpex470[] - a disk the daemon failed to place still has activity to show */
+	int busy[BAYS]; /* the disk is working right now */
+	int kind[BAYS]; /* what the current or last spell does - BLUE (writing), PURPLE (reading) or PURPLE | 4 (both) */
+	int moved[BAYS]; /* there was work since the last snapshot - its counters move at the next one */
+	int64_t next_change[BAYS]; /* ns when busy[] flips */
+	int64_t quiet_since[BAYS]; /* ns the disk last went quiet, meaningless while busy */
+	int64_t unshown[BAYS]; /* ns a spell started that no light has answered yet, -1 if none */
+	int pend[BAYS]; /* counters that moved since the light last came on - SIM_READ, SIM_WRITE. picks the colour it must come on in */
+	int fuzzy[BAYS]; /* a fault let the daemon take some of pend[] as its baseline - the next colour isn't checked */
+	int placed[BAYS]; /* bay the disk was in at the last init, 0 before the first */
+	int64_t worst_on; /* longest from a disk starting work to its light coming on, ns */
+	int64_t worst_lit; /* longest a light stayed on after its disk went quiet, ns */
+	u_int64_t ticks;
+	u_int64_t writes;
+	u_int64_t colours; /* lights whose colour was checked */
+	u_int64_t violations;
+	size_t seq;
+};
+#endif
+
+const char *VERSION = "1.2.0";
 char *progname;
 struct statinfo cur;
-int io;
+int io = -1;
 struct device_selection *dev_select;
 size_t maxshowdevs, run, num_devices;
 size_t global_count = 0;
-struct hpled ide0, ide1, ide2, ide3 ;
-struct hpled hpex470[4];
+struct hpled hpex470[BAYS];
+struct hpled hpex_prev[BAYS]; /* the bays before a re-init after a device change */
+size_t prev_count = 0;
 u_int16_t encreg;
 char *HD = "ide";
 devstat_select_mode select_mode;
@@ -181,29 +506,57 @@ char **specified_devices;
 size_t debug = 0; /* debug option default */
 size_t run_as_daemon = 0; /* daemon option default */
 size_t audit_mon = 0; /* audit light function in syslog */
-
-/* initialize struct statinfo cur, kvm_t *kd, and configure struct hpled ide0-3 */
+int devd = -1; /* devd event socket, -1 if devd is not available */
+struct hpstats stats;
+const struct statsrc *src = &devstat_src;
+const struct ledsink *sink = &port_sink;
+const struct hpclock *clk = &real_clock;
+#ifdef HPEX_SIMULATE
+struct hpsim sim;
+size_t sim_sequences = 0; /* --simulate */
+#endif
+u_int16_t dry_reg = CTL; /* the register as --sample would have left it */
+int led_chan = -1; /* our end of the channel to the LED writer */
+pid_t led_pid = -1; /* the LED writer, -1 once it has been reaped */
+int cam_chan = -1; /* our end of the channel to the CAM locator */
+pid_t cam_pid = -1; /* the CAM locator, -1 once it has been reaped */
+volatile sig_atomic_t child_exited = 0; /* SIGCHLD - a helper needs reaping */
+u_int16_t chan_reg = CTL; /* register image for the LED writer, sent on the next tick */
+int chan_dirty = 0;
+int status_fd = -1; /* --status listener, -1 if we are not serving */
+size_t sample_secs = 0; /* --sample: run this long without touching /dev/io, then report */
+int64_t sample_end = 0;
+int64_t rate_time = 0;
+size_t fault_rate = 0; /* --fault: fail roughly one stats call in fault_rate */
+size_t failures = 0; /* devstat failures in a row - drives the supervisor backoff */
+enum hpstate hp_state = HP_RUN; /* where the supervisor is */
+volatile sig_atomic_t dump_stats = 0;
+volatile sig_atomic_t stop_signal = 0; /* SIGTERM/SIGINT/SIGQUIT - the loops unwind to main(), which shuts down */
+
+/* initialize struct statinfo cur, kvm_t *kd, and configure struct hpled hpex470[]. returns the number of bays - 0 if devstat failed, the caller backs off and retries */
 size_t disk_init(void) 
 {
     size_t dn, di;
-    u_int64_t total_bytes_read, total_bytes_write;
     char *devicename;
-	struct cam_device *cam_dev = NULL;
-	long double etime = 1.00;
 	size_t disks = 0;
 	num_matches = 0;
 	matches = NULL;
 
-	if (devstat_buildmatch(HD, &matches, &num_matches) != 0)
-		errx(1, "%s in %s line %d", devstat_errbuf,__FUNCTION__, __LINE__);
+	if (devstat_buildmatch(HD, &matches, &num_matches) != 0) {
+		syslog(LOG_ERR, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
+		return 0;
+	}
 
 	if(debug) printf("\nAfter devstat_buildmatch - Matches = %d Number of Matches = %d \n", matches->num_match_categories, num_matches);
 
 	if (devstat_checkversion(kd) < 0)
 		errx(1, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
 
-	if ((num_devices = devstat_getnumdevs(kd)) < 0)
-		err(1, "can't get number of devices in %s line %d", __FUNCTION__, __LINE__);
+	if ((num_devices = devstat_getnumdevs(kd)) < 0) {
+		syslog(LOG_ERR, "can't get number of devices in %s line %d", __FUNCTION__, __LINE__);
+		disk_fini();
+		return 0;
+	}
 
 	if(debug) printf("Number of devices is: %ld \n", num_devices);
 
@@ -212,8 +565,12 @@ size_t disk_init(void)
 	if (cur.dinfo == NULL)
 		err(1, "calloc failed in %s line %d", __FUNCTION__, __LINE__);
 
-    if (devstat_getdevs(kd, &cur) == -1)
-        err(1, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
+    if (src->snapshot() == -1) {
+        syslog(LOG_ERR, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
+		disk_fini();
+		return 0;
+	}
+	++stats.snapshots;
 	
     specified_devices = calloc(num_matches, sizeof(char *));
 	
@@ -226,13 +583,17 @@ size_t disk_init(void)
 	if( specified_devices[0] == NULL )
 		err(1, "malloc failed for specified_devices[a]");
 	
-	if(num_devices != cur.dinfo->numdevs)
-		err(1, "Number of devices is inconsistent in %s line %d", __FUNCTION__, __LINE__);
+	/* a device came or went between the two calls - let the caller try again */
+	if(num_devices != cur.dinfo->numdevs) {
+		syslog(LOG_WARNING, "Number of devices is inconsistent in %s line %d", __FUNCTION__, __LINE__);
+		disk_fini();
+		return 0;
+	}
 
 	assert(sizeof(specified_devices[0]) > sizeof("4"));
 	strlcpy(specified_devices[0], "4", sizeof(specified_devices[0]));
 
-	maxshowdevs = 4;
+	maxshowdevs = BAYS;
 	num_devices = cur.dinfo->numdevs;
 	generation = cur.dinfo->generation;
 	num_devices_specified = num_matches;
@@ -257,144 +618,24 @@ size_t disk_init(void)
                             cur.dinfo->devices, num_devices, matches,
                             num_matches, specified_devices,
                             num_devices_specified, select_mode, maxshowdevs,
-                            0) == -1)
-    		errx(1, "%s", devstat_errbuf);
+                            0) == -1) {
+    	syslog(LOG_ERR, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
+		disk_fini();
+		return 0;
+	}
 
 
     for (dn = 0; dn < num_devices; dn++) {
 
-		if (dev_select[dn].selected > maxshowdevs)
-                       continue;
-
-        di = dev_select[dn].position;
-
-		if (devstat_compute_statistics(&cur.dinfo->devices[di], NULL, etime, DSM_TOTAL_BYTES_READ, &total_bytes_read, 				
-			DSM_TOTAL_BYTES_WRITE, &total_bytes_write, DSM_NONE) != 0)
-            err(1, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
-
         if ((dev_select[dn].selected == 0) || (dev_select[dn].selected > maxshowdevs))
                 continue;
 
+        di = dev_select[dn].position;
+
 	    if (asprintf(&devicename, "/dev/%s%d", cur.dinfo->devices[di].device_name, cur.dinfo->devices[di].unit_number) == -1)
 	 		errx(1, "asprintf"); 
 
-		cam_dev = cam_open_device(devicename, O_RDWR);
-
-		if(debug) {
-			printf("The device name is    : %s \n", devicename);
-			printf("CAM device name is    : %s \n", cam_dev->device_name);
-			printf("The Unit Number is    : %i \n", cam_dev->dev_unit_num);
-			printf("The Sim Name is       : %s \n", cam_dev->sim_name);
-			printf("The sim_unit_number is: %i \n", cam_dev->sim_unit_number);
-			printf("The bus_id is         : %i \n", cam_dev->bus_id);
-			printf("The target_lun is     : %li \n", cam_dev->target_lun);
-			printf("The target_id is      : %i \n", cam_dev->target_id);
-			printf("The path_id is        : %i \n", cam_dev->path_id);
-			printf("The pd_type is        : %i \n", cam_dev->pd_type);
-			printf("The file descriptor is: %i \n", cam_dev->fd);
-		}
-
-		/* on a HP EX47x there are only 4 IDE devices (provided you set the bios to 4(IDE) 4(IDE) per the mediasmart forum. These will always be the same */
-		/* rather than mess around with dynamically allocating and figuring them out, I'm just hardcoding them here */
-		if( cam_dev->path_id == 0 && cam_dev->target_id == 0) {
-			memset(&ide0.path, 0, sizeof(ide0.path));
-			assert(sizeof(devicename) < sizeof(ide0.path));
-			strlcpy(ide0.path, devicename, sizeof(ide0.path));
-			ide0.target_id = cam_dev->target_id;		
-			ide0.path_id = cam_dev->path_id;
-			ide0.dev_index = di;
-			ide0.b_read = total_bytes_read;
-			ide0.b_write = total_bytes_write;
-			ide0.n_read = 0;
-			ide0.n_write = 0;
-			ide0.HDD = 1;
-			hpex470[di] = ide0;
-
-			if(debug){
-				printf("HP Disk %d :\nTotal bytes read: %ld\nTotal bytes write: %ld\n\n",ide0.HDD, ide0.b_read, ide0.b_write);
-				printf("Now Monitoring %s in HP Mediasmart Server Slot %i \n\n",ide0.path, ide0.HDD);
-			}
-
-			syslog(LOG_NOTICE,"Now Monitoring %s in HP Mediasmart Server Slot %i for activity",ide0.path, ide0.HDD);
-			++disks;	
-		}
-		else if ( cam_dev->path_id == 0 && cam_dev->target_id == 1) {
-			memset(&ide1.path, 0, sizeof(ide1.path));
-			assert(sizeof(devicename) < sizeof(ide1.path));
-			strlcpy(ide1.path,devicename, sizeof(ide1.path));
-			ide1.target_id = cam_dev->target_id;		
-			ide1.path_id = cam_dev->path_id;
-			ide1.dev_index = di;
-			ide1.b_read = total_bytes_read;
-			ide1.b_write = total_bytes_write;
-			ide1.n_read = 0;
-			ide1.n_write = 0;
-			ide1.HDD = 2;
-			hpex470[di] = ide1;
-
-			if(debug){
-				printf("HP Disk %d :\nTotal bytes read: %ld \nTotal bytes write: %ld\n\n",ide1.HDD, ide1.b_read, ide1.b_write);
-				printf("Now Monitoring %s in HP Mediasmart Server Slot %i \n\n",ide1.path, ide1.HDD);
-			}
-
-			syslog(LOG_NOTICE,"Now Monitoring %s in HP Mediasmart Server Slot %i for activity",ide1.path, ide1.HDD);
-			++disks;
-
-		}
-		else if ( cam_dev->path_id == 1 && cam_dev->target_id == 0) {
-			memset(&ide2.path, 0, sizeof(ide2.path));
-			assert(sizeof(devicename) < sizeof(ide2.path));
-			strlcpy(ide2.path,devicename, sizeof(ide2.path));
-			ide2.target_id = cam_dev->target_id;		
-			ide2.path_id = cam_dev->path_id;
-			ide2.dev_index = di;
-			ide2.b_read = total_bytes_read;
-			ide2.b_write = total_bytes_write;
-			ide2.n_read = 0;
-			ide2.n_write = 0;
-			ide2.HDD = 3;
-			hpex470[di] = ide2;
-
-			if(debug){
-				printf("HP Disk %d :\nTotal bytes read: %ld\nTotal bytes write: %ld\n\n",ide2.HDD, ide2.b_read, ide2.b_write);
-				printf("Now Monitoring %s in HP Mediasmart Server Slot %i \n\n",ide2.path, ide2.HDD);
-			}
-
-			syslog(LOG_NOTICE,"Now Monitoring %s in HP Mediasmart Server Slot %i for activity",ide2.path, ide2.HDD);
-			++disks;
-
-		}
-		else if ( cam_dev->path_id == 1 && cam_dev->target_id == 1) {
-			memset(&ide3.path, 0, sizeof(ide3.path));
-			assert(sizeof(devicename) < sizeof(ide3.path));
-			strlcpy(ide3.path,devicename, sizeof(ide3.path));
-			ide3.target_id = cam_dev->target_id;		
-			ide3.path_id = cam_dev->path_id;
-			ide3.dev_index = di;
-			ide3.b_read = total_bytes_read;
-			ide3.b_write = total_bytes_write;
-			ide3.n_read = 0;
-			ide3.n_write = 0;
-			ide3.HDD = 4;
-			hpex470[di] = ide3;
-
-			if(debug){
-				printf("HP Disk %d :\nTotal bytes read: %ld \nTotal bytes write: %ld\n\n",ide3.HDD, ide3.b_read, ide3.b_write);
-				printf("Now Monitoring %s in HP Mediasmart Server Slot %i \n\n",ide3.path, ide3.HDD);
-			}
-
-			syslog(LOG_NOTICE,"Now Monitoring %s in HP Mediasmart Server Slot %i for activity",ide3.path, ide3.HDD);
-			++disks;
-
-		}
-		else { /* something went wrong here */
-			err(1, "unknown path_id or target_id in %s line %d", __FUNCTION__, __LINE__);
-		}
-
-		if(di > 3)
-			err(1, "Illegal number of devices - di = %ld in %s line %d", di, __FUNCTION__, __LINE__);
-
-		cam_close_device(cam_dev);
+		disks += bay_add(disks, devicename, di);
 		free(devicename);
 	}
 	free(specified_devices[0]);
@@ -409,21 +650,222 @@ size_t disk_init(void)
 	if(debug)
 		printf("\nThe number of disks is %ld in %s line %d\n", disks, __FUNCTION__, __LINE__);
 
+	/* devstat worked but none of the devices is in a bay - say so in the supervisor's backoff message */
+	if(disks == 0)
+		snprintf(devstat_errbuf, DEVSTAT_ERRBUF_SIZE, "no devices found in a bay");
+
+	rate_time = clk->now();
+
 	return (disks);
 };
- /* function to monitor disk activity. if a device change is detected, break and re-initialize */
-size_t run_mediasmart(void)
+/* release everything disk_init() allocated - safe to call more than once */
+void disk_fini(void)
+{
+	if(cur.dinfo != NULL) {
+		free(cur.dinfo->mem_ptr);
+		free(cur.dinfo);
+		cur.dinfo = NULL;
+	}
+	if(specified_devices != NULL) {
+		free(specified_devices[0]);
+		free(specified_devices);
+		specified_devices = NULL;
+	}
+	free(dev_select);
+	dev_select = NULL;
+	free(matches);
+	matches = NULL;
+};
+/* place devicename in hpex470[disks] and take its counters as the baseline. 1 if it is one of our bays, 0 if it was skipped */
+size_t bay_add(size_t disks, const char *devicename, size_t di)
+{
+	u_int64_t total_bytes_read, total_bytes_write, total_ops;
+	struct hpled *bay;
+	int path_id, target_id;
+
+	if(src->locate(devicename, &path_id, &target_id) != 0) {
+		if(!sample_secs) {
+			syslog(LOG_WARNING, "Unable to place %s in a bay - %s - not monitoring it", devicename, cam_errbuf);
+			return 0;
+		}
+		/* --sample without root - CAM won't tell us where the disk sits. the device is reported with its bay as unknown */
+		if(disks == 0)
+			syslog(LOG_NOTICE, "Unable to place %s - bay positions unknown without root, reporting by device only", devicename);
+		path_id = target_id = -1;
+	}
+	/* on a HP EX47x there are only 4 IDE devices (provided you set the bios to 4(IDE) 4(IDE) per the mediasmart forum. These will always be the same */
+	/* path_id 0/1 and target_id 0/1 give bays 1-4 - anything else is not one of ours */
+	else if(path_id < 0 || path_id > 1 || target_id < 0 || target_id > 1) {
+		syslog(LOG_WARNING, "%s has unknown path_id %d target_id %d - not monitoring it", devicename, path_id, target_id);
+		return 0;
+	}
+
+	if(disks >= BAYS) {
+		syslog(LOG_WARNING, "Illegal number of devices - ignoring %s (di = %ld)", devicename, di);
+		return 0;
+	}
+
+	bay = &hpex470[disks];
+	memset(bay, 0, sizeof(*bay));
+	strlcpy(bay->path, devicename, sizeof(bay->path));
+	bay->target_id = target_id;
+	bay->path_id = path_id;
+	bay->dev_index = di;
+	bay->HDD = (path_id < 0) ? 0 : path_id * 2 + target_id + 1; /* 0 - unknown bay, its led_mask row is empty */
+
+	/* a bay whose counters can't be read is still ours - it sits in quarantine until they can */
+	if (src->counters(di, &total_bytes_read, &total_bytes_write, &total_ops) != 0)
+		quarantine_bay(bay);
+	else {
+		bay->b_read = bay->r_read = bay->n_read = total_bytes_read;
+		bay->b_write = bay->r_write = bay->n_write = total_bytes_write;
+		bay->n_ops = bay->r_ops = total_ops;
+
+		/* a disk that stayed in its bay through a device change keeps its baseline, so work it did since the last pass still shows */
+		for(size_t p = 0; p < prev_count; p++) {
+			if(strcmp(hpex_prev[p].path, devicename) == 0 && hpex_prev[p].HDD == bay->HDD && hpex_prev[p].q_delay == 0) {
+				bay->b_read = hpex_prev[p].b_read;
+				bay->b_write = hpex_prev[p].b_write;
+				break;
+			}
+		}
+	}
+
+	if(debug){
+		printf("HP Disk %d :\nTotal bytes read: %ld\nTotal bytes write: %ld\n\n",bay->HDD, bay->b_read, bay->b_write);
+		printf("Now Monitoring %s in HP Mediasmart Server Slot %s \n\n",bay->path, slot_name(bay));
+	}
+
+	syslog(LOG_NOTICE,"Now Monitoring %s in HP Mediasmart Server Slot %s for activity",bay->path, slot_name(bay));
+	return 1;
+};
+/* devstat backend - where CAM says devicename sits. root asks CAM itself, nobody asks the CAM locator that kept root for it.
+   0 on success, -1 with cam_errbuf saying why - we never guess a bay from the device name */
+int cam_locate(const char *devicename, int *path_id, int *target_id)
+{
+	struct camreply reply;
+	ssize_t len;
+
+	if(geteuid() == 0)
+		return cam_lookup(devicename, path_id, target_id);
+
+	if(cam_chan < 0) {
+		snprintf(cam_errbuf, CAM_ERRBUF_SIZE, "CAM needs root and the CAM locator is not running");
+		return -1;
+	}
+
+	if(send(cam_chan, devicename, strlen(devicename) + 1, 0) >= 0) {
+		while((len = recv(cam_chan, &reply, sizeof(reply), 0)) < 0 && errno == EINTR)
+			;
+		if(len == sizeof(reply)) {
+			if(reply.rc != 0) {
+				strlcpy(cam_errbuf, reply.errbuf, CAM_ERRBUF_SIZE);
+				return -1;
+			}
+			*path_id = reply.path_id;
+			*target_id = reply.target_id;
+			return 0;
+		}
+	}
+
+	/* gone, or stuck past HELPER_TIMEOUT - a late answer would be taken for the next question, so stop asking */
+	syslog(LOG_ERR, "CAM locator has gone away - %m. Disks can't be placed until the daemon is restarted");
+	close(cam_chan);
+	cam_chan = -1;
+	if(cam_pid > 0)
+		kill(cam_pid, SIGKILL);
+	helpers_reap();
+	snprintf(cam_errbuf, CAM_ERRBUF_SIZE, "the CAM locator has gone away");
+	return -1;
+};
+/* ask CAM where devicename sits - opens the device, so only root. 0 on success, -1 with cam_errbuf set */
+int cam_lookup(const char *devicename, int *path_id, int *target_id)
+{
+	struct cam_device *cam_dev;
+
+	if((cam_dev = cam_open_device(devicename, O_RDWR)) == NULL)
+		return -1;
+
+	if(debug) {
+		printf("The device name is    : %s \n", devicename);
+		printf("CAM device name is    : %s \n", cam_dev->device_name);
+		printf("The Unit Number is    : %i \n", cam_dev->dev_unit_num);
+		printf("The Sim Name is       : %s \n", cam_dev->sim_name);
+		printf("The sim_unit_number is: %i \n", cam_dev->sim_unit_number);
+		printf("The bus_id is         : %i \n", cam_dev->bus_id);
+		printf("The target_lun is     : %li \n", cam_dev->target_lun);
+		printf("The target_id is      : %i \n", cam_dev->target_id);
+		printf("The path_id is        : %i \n", cam_dev->path_id);
+		printf("The pd_type is        : %i \n", cam_dev->pd_type);
+		printf("The file descriptor is: %i \n", cam_dev->fd);
+	}
+	*path_id = cam_dev->path_id;
+	*target_id = cam_dev->target_id;
+	cam_close_device(cam_dev);
+	return 0;
+};
+/* stop reading a bay whose counters errored. each failure in a row doubles the time out, from QUARANTINE_MIN to QUARANTINE_MAX */
+void quarantine_bay(struct hpled *bay)
+{
+	++bay->errors;
+	++stats.stat_errors;
+
+	if(bay->led_state)
+		bay->led_state = offled(bay->HDD, bay->last_color);
+
+	if(bay->q_delay == 0) {
+		++stats.quarantines;
+		bay->q_delay = QUARANTINE_MIN;
+		syslog(LOG_WARNING, "Quarantined %s in Slot %s - %s", bay->path, slot_name(bay), devstat_errbuf);
+	}
+	else
+		bay->q_delay = MIN(bay->q_delay * 2, QUARANTINE_MAX);
+
+	bay->q_until = clk->now() + bay->q_delay;
+};
+/* the bay number as we print it - "?" for a device --sample couldn't place without root */
+const char *slot_name(const struct hpled *bay)
+{
+	static const char *names[BAYS + 1] = { "?", "1", "2", "3", "4" };
+
+	return (bay->HDD > 0 && bay->HDD <= BAYS) ? names[bay->HDD] : "?";
+};
+/* monotonic clock in milliseconds for quarantine and backoff */
+int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+};
+ /* function to monitor disk activity. returns 1 if a device change is detected (re-initialize), -1 if devstat failed (back off) */
+int run_mediasmart(void)
 {
-    long double etime = 1.00;
 	int retval = 0;
+	int64_t now;
 	struct timespec t_led = { .tv_sec = 0, .tv_nsec = LED_DELAY };
 	struct timespec t_blink = { .tv_sec = 0, .tv_nsec = BLINK_DELAY };
+	struct timespec t_idle = t_led;
+	size_t idle_sweeps = 0, quiet;
+	int stale = 0;
 	// sigset_t sigempty;
 	// sigemptyset( &sigempty );
 
 	while( run ) {
 
-		retval = devstat_getdevs(kd, &cur);
+		if(dump_stats) {
+			dump_stats = 0;
+			log_stats();
+		}
+		/* asked to stop - hand back to supervise() as if the sample had ended */
+		if(stop_signal) {
+			retval = 0;
+			run = 0;
+			break;
+		}
+
+		retval = src->snapshot();
+		++stats.snapshots;
 
 		if( retval == 1) {
 			run = 0;
@@ -431,15 +873,54 @@ size_t run_mediasmart(void)
 		}
 		if( retval == -1) {
 			syslog(LOG_CRIT, "Bad return from devstat_getdevs() in function %s line %d",__FUNCTION__, __LINE__ );
-			fprintf(stderr, "invalid return from devstat_getdevs() in %s line %d", __FUNCTION__, __LINE__);
+			if(debug)
+				fprintf(stderr, "invalid return from devstat_getdevs() in %s line %d\n", __FUNCTION__, __LINE__);
+			run = 0;
+			break;
+		}
+		if(failures) {
+			syslog(LOG_NOTICE, "devstat recovered after %ld failures", failures);
+			failures = 0;
+			stale = 1;
+		}
+		now = clk->now();
+		if(sample_end && now >= sample_end) {
+			update_rates(now);
 			run = 0;
 			break;
 		}
+		quiet = 0;
 		for (int x = 0; x < global_count; x++) {
-			/* we only need read and write. we don't have a statinfo last thus NULL. etime isn't used in these stats but passed for completeness */
-			if (devstat_compute_statistics(&cur.dinfo->devices[hpex470[x].dev_index], NULL, etime,
-     		    DSM_TOTAL_BYTES_READ, &hpex470[x].n_read, DSM_TOTAL_BYTES_WRITE, &hpex470[x].n_write, DSM_NONE) != 0)
-					err(1, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
+			/* quarantined bays count as quiet until their time is up, and take their LED_DELAY like a quiet bay */
+			/* so a box with every bay quarantined paces itself and goes idle rather than spinning on snapshots */
+			if(hpex470[x].q_until > now ||
+				src->counters(hpex470[x].dev_index, &hpex470[x].n_read, &hpex470[x].n_write, &hpex470[x].n_ops) != 0) {
+				if(hpex470[x].q_until <= now)
+					quarantine_bay(&hpex470[x]);
+				++quiet;
+				if(idle_sweeps < IDLE_SWEEPS)
+					clk->sleep(&t_led);
+				continue;
+			}
+
+			if(hpex470[x].q_delay) {
+				/* back from quarantine - take the counters as they are now rather than blink for everything we missed */
+				syslog(LOG_NOTICE, "%s in Slot %s recovered after %ju errors", hpex470[x].path, slot_name(&hpex470[x]), (uintmax_t)hpex470[x].errors);
+				++stats.recoveries;
+				hpex470[x].q_delay = 0;
+				hpex470[x].q_until = 0;
+				hpex470[x].b_read = hpex470[x].r_read = hpex470[x].n_read;
+				hpex470[x].b_write = hpex470[x].r_write = hpex470[x].n_write;
+				hpex470[x].r_ops = hpex470[x].n_ops;
+			}
+			else if(stale) {
+				/* first pass after devstat itself failed - what the counters gained during the backoff is just as old */
+				hpex470[x].b_read = hpex470[x].n_read;
+				hpex470[x].b_write = hpex470[x].n_write;
+			}
+
+			if ((hpex470[x].b_read != hpex470[x].n_read) || (hpex470[x].b_write != hpex470[x].n_write))
+				idle_sweeps = 0; /* activity - leave idle before the other bays take their turn */
 
 			if ((hpex470[x].b_read != hpex470[x].n_read) && (hpex470[x].b_write != hpex470[x].n_write)) {
 				/* we both read and wrote at the same time */
@@ -451,12 +932,14 @@ size_t run_mediasmart(void)
 				
 				if(hpex470[x].led_state){
 					offled(hpex470[x].HDD, hpex470[x].last_color); /* turn off the LED */
-					nanosleep(&t_blink, NULL); /* wait a moment */
+					clk->sleep(&t_blink); /* wait a moment */
 				}
 
 				hpex470[x].led_state = blt(hpex470[x].HDD); /* blink blue - returns 1 */
+				hpex470[x].color = BLUE;
+				++hpex470[x].lit[BLUE];
 				hpex470[x].last_color = PURPLE; /* set the last color - NOTE: this is always purple to avoid leaving red on if last was purple and next is blue */
-				nanosleep(&t_blink, NULL); /* wait moment before moving on */
+				clk->sleep(&t_blink); /* wait moment before moving on */
 			}
 			else if (hpex470[x].b_read != hpex470[x].n_read ) {
 				/* we read some number of bytes */
@@ -467,12 +950,14 @@ size_t run_mediasmart(void)
 
 				if(hpex470[x].led_state){
 					offled(hpex470[x].HDD, hpex470[x].last_color);
-					nanosleep(&t_blink, NULL);
+					clk->sleep(&t_blink);
 				}
 				
 				hpex470[x].led_state = plt(hpex470[x].HDD); 
+				hpex470[x].color = PURPLE;
+				++hpex470[x].lit[PURPLE];
 				hpex470[x].last_color = PURPLE;
-				nanosleep(&t_blink, NULL);
+				clk->sleep(&t_blink);
 			}
 			else if (hpex470[x].b_write != hpex470[x].n_write) {
 				/* we wrote some number of bytes */
@@ -483,19 +968,25 @@ size_t run_mediasmart(void)
 
 				if(hpex470[x].led_state){
 					offled(hpex470[x].HDD, hpex470[x].last_color);
-					nanosleep(&t_blink, NULL);
+					clk->sleep(&t_blink);
 				}
 				
 				hpex470[x].led_state = blt(hpex470[x].HDD);
+				hpex470[x].color = BLUE;
+				++hpex470[x].lit[BLUE];
 				hpex470[x].last_color = PURPLE;
-				nanosleep(&t_blink, NULL);
+				clk->sleep(&t_blink);
 			}
 			else {
-				nanosleep(&t_led, NULL);
+				++quiet;
+				/* once idle every light is already off - the single idle wait below stands in for the per bay delay */
+				if(idle_sweeps < IDLE_SWEEPS)
+					clk->sleep(&t_led);
 				if(hpex470[x].led_state) {
 					/* we turn off the leds */
 					/* off_color: 1 = blue    2 = red    3 = purple - the return is always 0 */
 					hpex470[x].led_state = offled(hpex470[x].HDD, hpex470[x].last_color);
+					++hpex470[x].dark;
 				}
 				/* pause for a brief word from our sponsors */
 				/* pselect(0, NULL, NULL, NULL, &t_wait, &sigempty); */
@@ -503,138 +994,1075 @@ size_t run_mediasmart(void)
 			}
 
 		}
+		stale = 0;
+
+		update_rates(now);
 
+		if(quiet < global_count) {
+			t_idle = t_led;
+			continue;
+		}
+		if(idle_sweeps < IDLE_SWEEPS) {
+			++idle_sweeps;
+			continue;
+		}
+		/* idle - one wait per pass that doubles up to IDLE_MAX_DELAY. a devd event cuts it short and drops us out of idle */
+		++stats.idle_sleeps;
+		if(clk->sleep(&t_idle)) {
+			idle_sweeps = 0;
+			t_idle = t_led;
+			continue;
+		}
+		t_idle.tv_nsec *= 2;
+		if(t_idle.tv_nsec >= 1000000000) {
+			++t_idle.tv_sec;
+			t_idle.tv_nsec -= 1000000000;
+		}
+		if((t_idle.tv_sec * 1000000000L + t_idle.tv_nsec) > IDLE_MAX_DELAY) {
+			t_idle.tv_sec = IDLE_MAX_DELAY / 1000000000;
+			t_idle.tv_nsec = IDLE_MAX_DELAY % 1000000000;
+		}
 	}
 	return(retval);
 };
-/* blue led toggle */
+/* the supervisor - monitor, re-initialize on hotswap, and back off when devstat fails. only a signal stops the daemon,
+   --simulate stops it at sample_end. with until_placed it returns as soon as an init has found the bays - main() holds on
+   to root until then, so the first placement doesn't depend on the CAM locator */
+void supervise(int until_placed)
+{
+	enum hpstate next = HP_RUN;
+	time_t backoff;
+	struct timespec t_backoff;
+
+	hp_state = HP_RUN;
+
+	if(global_count == 0) {
+		++stats.init_errors;
+		++failures;
+		hp_state = HP_BACKOFF;
+		next = HP_INIT;
+	}
+
+	while(!stop_signal && (!sample_end || clk->now() < sample_end)) {
+
+		if(until_placed && hp_state == HP_RUN)
+			return;
+
+		switch (hp_state) {
+			case HP_INIT:
+				/* after a device change the bays that stay keep their baselines. after failures those are stale */
+				prev_count = failures ? 0 : global_count;
+				memcpy(hpex_prev, hpex470, sizeof(hpex_prev));
+				leds_off();
+				disk_fini();
+				global_count = src->init();
+				prev_count = 0;
+
+				if(debug)
+					printf("The global count is %ld \n", global_count);
+
+				if(global_count == 0) {
+					++stats.init_errors;
+					++failures;
+					hp_state = HP_BACKOFF;
+					next = HP_INIT;
+					break;
+				}
+				hp_state = HP_RUN;
+				break;
+			case HP_RUN:
+				run = 1;
+				switch(run_mediasmart()) {
+					case 0: /* sample_end */
+						return;
+					case 1:
+						syslog(LOG_NOTICE, "New or removed device detected - reinitializing");
+						if(debug)
+							fprintf(stderr, "\n\n**** New/Removed Device Detected - re-initializing ****\n\n");
+						hp_state = HP_INIT;
+						break;
+					default:
+						++stats.snapshot_errors;
+						++failures;
+						/* retry the snapshot a few times, then assume the device list is stale and start over */
+						hp_state = HP_BACKOFF;
+						next = (failures >= SNAPSHOT_RETRIES) ? HP_INIT : HP_RUN;
+						break;
+				}
+				break;
+			case HP_BACKOFF:
+				/* 1, 2, 4 ... seconds up to BACKOFF_MAX. a devd event ends the wait early - the hotswap may be the cure */
+				backoff = (failures > 6) ? BACKOFF_MAX : MIN(BACKOFF_MIN << (failures - 1), BACKOFF_MAX);
+				syslog(LOG_ERR, "%s - failure %ld, retrying in %jd seconds", devstat_errbuf, failures, (intmax_t)backoff);
+				leds_off();
+				t_backoff.tv_sec = backoff;
+				t_backoff.tv_nsec = 0;
+				/* --sample ends on time, even in the middle of a backoff */
+				if(sample_end && sample_end - clk->now() < backoff * 1000) {
+					t_backoff.tv_sec = MAX(sample_end - clk->now(), 0) / 1000;
+					t_backoff.tv_nsec = (MAX(sample_end - clk->now(), 0) % 1000) * 1000000;
+				}
+				clk->sleep(&t_backoff);
+				hp_state = next;
+				break;
+		}
+	}
+};
+/* devstat backend - a fresh snapshot into cur */
+int devstat_snapshot(void)
+{
+	return devstat_getdevs(kd, &cur);
+};
+/* devstat backend - we only need read, write and transfers. we don't have a statinfo last thus NULL. etime isn't used in these stats but passed for completeness */
+int devstat_counters(size_t di, u_int64_t *b_read, u_int64_t *b_write, u_int64_t *ops)
+{
+	long double etime = 1.00;
+
+	return devstat_compute_statistics(&cur.dinfo->devices[di], NULL, etime,
+		DSM_TOTAL_BYTES_READ, b_read, DSM_TOTAL_BYTES_WRITE, b_write, DSM_TOTAL_TRANSFERS, ops, DSM_NONE);
+};
+/* fault backend - devstat, except roughly one call in fault_rate fails the way devstat would */
+int fault_snapshot(void)
+{
+	if(random() % fault_rate == 0) {
+		snprintf(devstat_errbuf, DEVSTAT_ERRBUF_SIZE, "injected snapshot fault");
+		return -1;
+	}
+	return devstat_snapshot();
+};
+int fault_counters(size_t di, u_int64_t *b_read, u_int64_t *b_write, u_int64_t *ops)
+{
+	if(random() % fault_rate == 0) {
+		snprintf(devstat_errbuf, DEVSTAT_ERRBUF_SIZE, "injected statistics fault on device %ld", di);
+		return -1;
+	}
+	return devstat_counters(di, b_read, b_write, ops);
+};
+/* port sink - the enclosure LED register */
+void port_write(u_int16_t reg)
+{
+	outw(ADDR, reg);
+};
+u_int16_t port_read(void)
+{
+	return inw(ADDR);
+};
+/* dry run sink for --sample - the LED decisions are counted in struct hpled, the register goes nowhere */
+void dry_write(u_int16_t reg)
+{
+	dry_reg = reg;
+};
+u_int16_t dry_read(void)
+{
+	return dry_reg;
+};
+/* LED writer sink - changes are coalesced into one register image and sent at most once per tick by chan_flush() */
+void chan_write(u_int16_t reg)
+{
+	chan_reg = reg;
+	chan_dirty = 1;
+};
+u_int16_t chan_read(void)
+{
+	return chan_reg;
+};
+void chan_flush(void)
+{
+	if(child_exited)
+		helpers_reap();
+
+	if(!chan_dirty || led_chan < 0)
+		return;
+
+	if(send(led_chan, &chan_reg, sizeof(chan_reg), MSG_DONTWAIT) == sizeof(chan_reg)) {
+		chan_dirty = 0;
+		++stats.led_messages;
+		return;
+	}
+	/* a full channel just means the writer is behind - the image stays dirty and goes next tick */
+	if(errno == EAGAIN || errno == EINTR)
+		return;
+
+	syslog(LOG_ERR, "LED writer has gone away - %m. Monitoring continues without lights");
+	close(led_chan);
+	led_chan = -1;
+	helpers_reap();
+};
+/* write the LED register. callers only ask for a change - --simulate counts a write of the current value against them */
+void led_set(u_int16_t reg)
+{
+	encreg = reg;
+	++stats.led_writes;
+	sink->write(encreg);
+};
+/* blue led toggle. bay 0 (not placed - --sample without root) has an empty led_mask row, so here and in rlt/plt/offled
+   the caller's LED decision is all there is - no register write that changes nothing */
 int blt(int bay_led)
 {
-   switch (bay_led) {
-      case HDD1:
-         encreg &= ~BL1;
-         break;
-      case HDD2:
-         encreg &= ~BL2;
-         break;
-      case HDD3:
-         encreg &= ~BL3;
-         break;
-      case HDD4:
-         encreg &= ~BL4;
-         break;
-   }
-   outw(ADDR, encreg);
-   return 1;
+	if(bay_led != 0)
+		led_set(encreg & ~led_mask[bay_led & (LED_ROWS - 1)][BLUE]);
+	return 1;
 };
 
 /* red led toggle */
 int rlt(int bay_led)
 {
-   switch (bay_led) {
-      case HDD1:
-         encreg &= ~RL1;
-         break;
-      case HDD2:
-         encreg &= ~RL2;
-         break;
-      case HDD3:
-         encreg &= ~RL3;
-         break;
-      case HDD4:
-         encreg &= ~RL4;
-         break;
-   }
-   outw(ADDR, encreg);
-   return 1;
+	if(bay_led != 0)
+		led_set(encreg & ~led_mask[bay_led & (LED_ROWS - 1)][RED]);
+	return 1;
 };
 
 /* purple led toggle */
 int plt(int bay_led)
 {
-	switch (bay_led) {
-  	   case HDD1:
-	      encreg &= ~PL1;
-	      break;
-	   case HDD2:
-	      encreg &= ~PL2;
-	      break;
-	   case HDD3:
-	      encreg &= ~PL3;
-	      break;
-	   case HDD4:
-	      encreg &= ~PL4;
-	      break;
-	}
-	outw(ADDR, encreg);
+	if(bay_led != 0)
+		led_set(encreg & ~led_mask[bay_led & (LED_ROWS - 1)][PURPLE]);
 	return 1;
 };
 /* turn off the bay light led based on last color */
 int offled(int bay_led, int off_color )
 {
 	/* 1 = blue    2 = red    3 = purple */
-	encreg = inw(ADDR);
-	switch( off_color ) {
-	case 1:
-		switch (bay_led) {
-			case HDD1:
-				encreg |= BL1;
-				break;
-			case HDD2:
-				encreg |= BL2;
-				break;
-			case HDD3:
-				encreg |= BL3;
-				break;
-			case HDD4:
-				encreg |= BL4;
-				break;
+	encreg = sink->read();
+	if(bay_led != 0)
+		led_set(encreg | led_mask[bay_led & (LED_ROWS - 1)][off_color & PURPLE]);
+	/* return (inw(ADDR) == OFFSTATE) ? 0 : 1 ; */
+	return 0;
+};
+/* sleep for ts, answering --status and waking early on a devd event. returns 1 if devd had something to say, 0 otherwise */
+int hp_sleep(const struct timespec *ts)
+{
+	struct pollfd pfd[2];
+	char buf[1024];
+	ssize_t len;
+	int events = 0, nfds;
+	int64_t end, left;
+
+	++stats.wakeups;
+
+	if(sink->flush != NULL)
+		sink->flush();
+
+	if(devd < 0 && status_fd < 0) {
+		nanosleep(ts, NULL);
+		return 0;
+	}
+
+	end = now_ms() + ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+
+	/* a --status request doesn't end the sleep - go back to waiting out the rest of it */
+	while(events == 0 && (left = end - now_ms()) > 0) {
+		nfds = 0;
+		if(devd >= 0) {
+			pfd[nfds].fd = devd;
+			pfd[nfds].events = POLLIN;
+			pfd[nfds++].revents = 0;
+		}
+		if(status_fd >= 0) {
+			pfd[nfds].fd = status_fd;
+			pfd[nfds].events = POLLIN;
+			pfd[nfds++].revents = 0;
+		}
+
+		if(poll(pfd, nfds, left) <= 0)
+			break;
+
+		for(int i = 0; i < nfds; i++) {
+			if(pfd[i].revents == 0)
+				continue;
+
+			if(pfd[i].fd == status_fd) {
+				status_serve();
+				continue;
 			}
-		break;
-	case 2:
-		switch (bay_led) {
-			case HDD1:
-				encreg |= RL1;
-				break;
-			case HDD2:
-				encreg |= RL2;
-				break;
-			case HDD3:
-				encreg |= RL3;
-				break;
-			case HDD4:
-				encreg |= RL4;
-				break;
+
+			/* we don't care what the event was - only that something attached, detached or changed */
+			while((len = recv(devd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+				++events;
+
+			if(len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+				/* devd went away - fall back to plain sleeps */
+				syslog(LOG_NOTICE, "Lost connection to devd - idle mode will sleep without early wakeup");
+				close(devd);
+				devd = -1;
 			}
-		break;
-	case 3:
-		switch (bay_led) {
-			case HDD1:
-				encreg |= PL1;
-				break;
-			case HDD2:
-				encreg |= PL2;
-				break;
-			case HDD3:
-				encreg |= PL3;
-				break;
-			case HDD4:
-				encreg |= PL4;
-				break;
 		}
-		break;
+	}
+
+	stats.devd_events += events;
+	return (events > 0);
+};
+/* connect to the devd event socket so idle sleeps can be cut short by hotswap. returns the socket or -1 */
+int devd_connect(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if((fd = socket(PF_LOCAL, SOCK_SEQPACKET, 0)) < 0)
+		return -1;
 
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_LOCAL;
+	strlcpy(addr.sun_path, DEVD_PIPE, sizeof(addr.sun_path));
+
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
 	}
-	outw(ADDR, encreg);
-	/* return (inw(ADDR) == OFFSTATE) ? 0 : 1 ; */
+
+	if(debug)
+		printf("Connected to devd at %s for hotswap events\n", DEVD_PIPE);
+
+	return fd;
+};
+/* report wakeups, devstat snapshots and cpu time since start */
+void log_stats(void)
+{
+	struct rusage ru;
+	time_t up = time(NULL) - stats.started;
+
+	if(up <= 0)
+		up = 1;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	syslog(LOG_NOTICE, "Stats: up %jds wakeups %ju (%.2f/s) snapshots %ju (%.2f/s) idle sleeps %ju devd events %ju cpu user %ld.%06lds sys %ld.%06lds",
+		(intmax_t)up, (uintmax_t)stats.wakeups, (double)stats.wakeups / up, (uintmax_t)stats.snapshots, (double)stats.snapshots / up,
+		(uintmax_t)stats.idle_sleeps, (uintmax_t)stats.devd_events,
+		(long)ru.ru_utime.tv_sec, (long)ru.ru_utime.tv_usec, (long)ru.ru_stime.tv_sec, (long)ru.ru_stime.tv_usec);
+	syslog(LOG_NOTICE, "Errors: snapshot %ju init %ju statistics %ju quarantines %ju recoveries %ju",
+		(uintmax_t)stats.snapshot_errors, (uintmax_t)stats.init_errors, (uintmax_t)stats.stat_errors,
+		(uintmax_t)stats.quarantines, (uintmax_t)stats.recoveries);
+	syslog(LOG_NOTICE, "LED register writes %ju, messages to the LED writer %ju", (uintmax_t)stats.led_writes, (uintmax_t)stats.led_messages);
+	for(int x = 0; x < global_count; x++)
+		syslog(LOG_NOTICE, "Slot %s %s: errors %ju%s", slot_name(&hpex470[x]), hpex470[x].path, (uintmax_t)hpex470[x].errors,
+			hpex470[x].q_delay ? " (quarantined)" : "");
+};
+/* throughput, IOPS and LED decisions per RATE_INTERVAL - read by --status, printed as we go by --sample */
+void update_rates(int64_t now)
+{
+	struct hpled *bay;
+	double secs;
+
+	if(now - rate_time < RATE_INTERVAL)
+		return;
+
+	secs = (now - rate_time) / 1000.0;
+	rate_time = now;
+
+	for(int x = 0; x < global_count; x++) {
+		bay = &hpex470[x];
+		bay->rate_read = (bay->n_read - bay->r_read) / secs;
+		bay->rate_write = (bay->n_write - bay->r_write) / secs;
+		bay->iops = (bay->n_ops - bay->r_ops) / secs;
+		bay->r_read = bay->n_read;
+		bay->r_write = bay->n_write;
+		bay->r_ops = bay->n_ops;
+
+		if(sample_secs)
+			printf("%4.0fs  Slot %s %-10s read %10.1f KB/s  write %10.1f KB/s  %8.1f IOPS  LED %s\n",
+				sample_secs - (sample_end - now) / 1000.0, slot_name(bay), bay->path, bay->rate_read / 1024, bay->rate_write / 1024,
+				bay->iops, bay->led_state ? (bay->color == PURPLE ? "purple" : "blue") : "off");
+	}
+	if(sample_secs)
+		fflush(stdout);
+};
+/* write the bay map, rates and LED state to fd - the --status report */
+void status_report(int fd)
+{
+	struct hpled *bay;
+
+	dprintf(fd, "%s %s - board %s, LEDs to %s, stats from %s\n", progname, VERSION, BOARD_NAME, sink->name, src->name);
+	dprintf(fd, "up %jds, wakeups %ju, snapshots %ju, idle sleeps %ju, devstat failures %ld, register writes %ju, LED writer messages %ju\n",
+		(intmax_t)(time(NULL) - stats.started), (uintmax_t)stats.wakeups, (uintmax_t)stats.snapshots,
+		(uintmax_t)stats.idle_sleeps, failures, (uintmax_t)stats.led_writes, (uintmax_t)stats.led_messages);
+	dprintf(fd, "%-4s %-10s %4s %6s %12s %12s %9s %-7s %8s %8s %8s %6s\n",
+		"Slot", "Device", "Path", "Target", "Read KB/s", "Write KB/s", "IOPS", "LED", "Blue", "Purple", "Off", "Errors");
+
+	for(int x = 0; x < global_count; x++) {
+		bay = &hpex470[x];
+		dprintf(fd, "%-4s %-10s %4i %6i %12.1f %12.1f %9.1f %-7s %8ju %8ju %8ju %6ju%s\n",
+			slot_name(bay), bay->path, bay->path_id, bay->target_id, bay->rate_read / 1024, bay->rate_write / 1024, bay->iops,
+			bay->led_state ? (bay->color == PURPLE ? "purple" : "blue") : "off",
+			(uintmax_t)bay->lit[BLUE], (uintmax_t)bay->lit[PURPLE], (uintmax_t)bay->dark, (uintmax_t)bay->errors,
+			bay->q_delay ? " quarantined" : "");
+	}
+};
+/* listen on STATUS_SOCK for --status. returns the socket or -1 */
+int status_listen(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if((fd = socket(PF_LOCAL, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_LOCAL;
+	strlcpy(addr.sun_path, STATUS_SOCK, sizeof(addr.sun_path));
+	unlink(STATUS_SOCK);
+
+	/* the report is read only - anyone on the box may ask for it */
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || chmod(STATUS_SOCK, 0666) < 0 ||
+		listen(fd, 4) < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+		syslog(LOG_WARNING, "Unable to listen on %s - --status will not work: %m", STATUS_SOCK);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+};
+/* answer one --status connection */
+void status_serve(void)
+{
+	int fd;
+
+	if((fd = accept(status_fd, NULL, NULL)) < 0)
+		return;
+
+	status_report(fd);
+	close(fd);
+};
+/* --status: print the running daemon's report */
+int show_status(void)
+{
+	struct sockaddr_un addr;
+	char buf[1024];
+	ssize_t len;
+	int fd;
+
+	if((fd = socket(PF_LOCAL, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_LOCAL;
+	strlcpy(addr.sun_path, STATUS_SOCK, sizeof(addr.sun_path));
+
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		err(1, "Unable to reach the daemon on %s - is it running?", STATUS_SOCK);
+
+	while((len = read(fd, buf, sizeof(buf))) > 0)
+		fwrite(buf, 1, len, stdout);
+
+	close(fd);
+	return 0;
+};
+/* --sample: run the monitor for secs seconds with the LED writes going nowhere, then report. no root needed */
+int sample_run(size_t secs)
+{
+	sink = &dry_sink;
+	stats.started = time(NULL);
+	sample_end = clk->now() + secs * 1000;
+
+	global_count = src->init();
+
+	if(global_count == 0)
+		printf("No bays found yet - %s. Retrying until the sample ends\n", devstat_errbuf);
+	else {
+		printf("Sampling %ld bays for %ld seconds - stats from %s, LEDs to %s\n", global_count, secs, src->name, sink->name);
+		if(hpex470[0].HDD == 0)
+			printf("Bay positions unknown without root - device only, slots shown as ?\n");
+	}
+
+	/* the daemon's supervisor - devstat failures and device changes back off and re-initialize, they don't end the sample */
+	supervise(0);
+
+	if(global_count == 0)
+		errx(1, "No bays found - %s", devstat_errbuf);
+
+	printf("\n");
+	fflush(stdout);
+	status_report(STDOUT_FILENO);
+	disk_fini();
+	return 0;
+};
+#ifdef HPEX_SIMULATE
+/* simulated clock - time only moves when the monitor sleeps, and the disks' activity moves with it */
+int64_t sim_now(void)
+{
+	return sim.now_ns / 1000000;
+};
+int sim_sleep(const struct timespec *ts)
+{
+	int64_t ns = ts->tv_sec * 1000000000L + ts->tv_nsec;
+
+	++sim.ticks;
+	++stats.wakeups;
+
+	for(int x = 0; x < global_count; x++)
+		if(hpex470[x].q_delay > QUARANTINE_MAX && ++sim.violations <= 10)
+			printf("sequence %ld: %s quarantined for %.1fs at %.1fms\n", sim.seq, hpex470[x].path, hpex470[x].q_delay / 1000.0, sim.now_ns / 1e6);
+
+	if(hp_state == HP_BACKOFF) {
+		/* the supervisor's wait - BACKOFF_MIN to BACKOFF_MAX seconds, and no more than double the one before */
+		++sim.backoffs;
+		if((ns < BACKOFF_MIN * 1000000000L || ns > BACKOFF_MAX * 1000000000L || (sim.backoff && ns > 2 * sim.backoff)) &&
+			++sim.violations <= 10)
+			printf("sequence %ld: backoff of %.1fs after %.1fs at %.1fms\n", sim.seq, ns / 1e9, sim.backoff / 1e9, sim.now_ns / 1e6);
+		sim.backoff = ns;
+	}
+
+	sim_advance(sim.now_ns + ns);
+	sim.now_ns += ns;
+	return 0;
+};
+/* roughly one call in fault_rate fails until faults_until */
+int sim_fault(void)
+{
+	return (sim.fault_rate && sim.now_ns < sim.faults_until && random() % sim.fault_rate == 0);
+};
+/* is disk x's bay lit in the simulated register */
+int sim_lit(int x)
+{
+	u_int16_t mask = led_mask[sim.hdd[x] & (LED_ROWS - 1)][PURPLE];
+
+	return (sim.reg & mask) != mask;
+};
+/* run the disks forward to ns - each one flips between quiet and busy spells of random length, from a few ms to a few seconds.
+   the register can't change during a sleep, so the lights are checked just before each flip and at the end - the moments a
+   lit quiet bay or an unanswered spell is oldest */
+void sim_advance(int64_t to)
+{
+	static const int64_t spell[] = { 5, 40, 150, 600, 2500, 8000 }; /* ms */
+	int64_t t;
+	int x;
+
+	while(1) {
+		x = -1;
+		for(int d = 0; d < sim.disks; d++)
+			if(sim.next_change[d] <= to && (x < 0 || sim.next_change[d] < sim.next_change[x]))
+				x = d;
+		if(x < 0)
+			break;
+
+		t = sim.next_change[x];
+		sim_check(t);
+
+		if(sim.busy[x]) {
+			sim.busy[x] = 0;
+			sim.quiet_since[x] = t;
+		}
+		else {
+			sim.busy[x] = 1;
+			sim.kind[x] = (int []){ BLUE, PURPLE, PURPLE | 4 }[random() % 3];
+			sim.moved[x] = 1;
+			/* a light that is already on shows this spell as well as any. until the faults have settled there is no promise */
+			if(!sim_lit(x) && sim.unshown[x] < 0 && t >= sim.settled)
+				sim.unshown[x] = t;
+		}
+		sim.next_change[x] += (1 + random() % spell[random() % 6]) * 1000000L;
+	}
+	sim_check(to);
+};
+/* hold the lights to SIM_MAX_ON and SIM_MAX_LIT at time t, and dark while the supervisor backs off */
+void sim_check(int64_t t)
+{
+	int64_t lit;
+
+	for(int x = 0; x < sim.disks; x++) {
+		if(sim.unshown[x] >= 0 && t - sim.unshown[x] > SIM_MAX_ON * 1000000L) {
+			if(++sim.violations <= 10)
+				printf("sequence %ld: Slot %i started work at %.1fms and its light was still off %dms later\n",
+					sim.seq, sim.hdd[x], sim.unshown[x] / 1000000.0, SIM_MAX_ON);
+			sim.unshown[x] = -1;
+		}
+
+		if(!sim_lit(x))
+			continue;
+
+		if(hp_state == HP_BACKOFF && ++sim.violations <= 10)
+			printf("sequence %ld: Slot %i lit during a backoff at %.1fms\n", sim.seq, sim.hdd[x], t / 1000000.0);
+
+		if(sim.busy[x])
+			continue;
+
+		lit = t - sim.quiet_since[x];
+		if(lit > sim.worst_lit)
+			sim.worst_lit = lit;
+		if(lit > SIM_MAX_LIT * 1000000L) {
+			if(++sim.violations <= 10)
+				printf("sequence %ld: Slot %i went quiet at %.1fms and its light was still on %dms later\n",
+					sim.seq, sim.hdd[x], sim.quiet_since[x] / 1000000.0, SIM_MAX_LIT);
+			sim.quiet_since[x] = t; /* once per quiet spell, not once per tick */
+		}
+	}
+};
+/* simulated disk_init() - the disks are /dev/sim0.. in devstat order and are placed by bay_add() like real ones */
+size_t sim_init(void)
+{
+	char name[24];
+	size_t disks = 0;
+
+	if(sim_fault()) {
+		for(int x = 0; x < sim.disks; x++)
+			sim.fuzzy[x] = 1;
+		snprintf(devstat_errbuf, DEVSTAT_ERRBUF_SIZE, "simulated init fault");
+		return 0;
+	}
+	sim.stale = 0;
+
+	/* disk_init() baselines from a fresh snapshot - so does this. a disk new to its bay starts from here, one that stayed
+	   keeps what it had pending. fuzzy[] stays - after failures the first pass re-baselines every bay again */
+	sim_move();
+	for(int x = 0; x < sim.disks; x++) {
+		if(sim.placed[x] != sim.hdd[x])
+			sim.pend[x] = 0;
+		sim.placed[x] = sim.hdd[x];
+	}
+
+	for(int x = 0; x < sim.disks; x++) {
+		snprintf(name, sizeof(name), "/dev/sim%d", x);
+		disks += bay_add(disks, name, x);
+	}
+
+	if(disks == 0)
+		snprintf(devstat_errbuf, DEVSTAT_ERRBUF_SIZE, "no devices found in a bay");
+
+	rate_time = clk->now();
+	return disks;
+};
+/* simulated CAM - knows where every disk sits right now, like CAM asked directly or through the CAM locator */
+int sim_locate(const char *devicename, int *path_id, int *target_id)
+{
+	int x;
+
+	if(sscanf(devicename, "/dev/sim%d", &x) != 1 || x < 0 || x >= sim.disks) {
+		snprintf(cam_errbuf, CAM_ERRBUF_SIZE, "no such simulated disk");
+		return -1;
+	}
+
+	*path_id = (sim.hdd[x] - 1) / 2;
+	*target_id = (sim.hdd[x] - 1) % 2;
+	return 0;
+};
+/* simulated devstat - a snapshot moves the counters of every disk that worked since the last one. now and then the device list
+   changes - and sometimes that is a disk pulled and put back in another bay under the same name, or a disk added to an empty bay */
+int sim_snapshot(void)
+{
+	int bays[BAYS], empty = 0, x;
+
+	if(sim.stale || sim_fault()) {
+		/* some faults stay until the device list is read again - SNAPSHOT_RETRIES is there for those */
+		if(!sim.stale && random() % 4 == 0)
+			sim.stale = 1;
+		for(x = 0; x < sim.disks; x++)
+			sim.fuzzy[x] = 1;
+		snprintf(devstat_errbuf, DEVSTAT_ERRBUF_SIZE, "simulated snapshot fault");
+		return -1;
+	}
+	sim.backoff = 0;
+
+	if(random() % 500 == 0) {
+		++sim.reinits;
+		for(int b = 1; b <= BAYS; b++) {
+			for(x = 0; x < sim.disks && sim.hdd[x] != b; x++)
+				;
+			if(x == sim.disks)
+				bays[empty++] = b;
+		}
+		if(empty && random() % 3 == 1) {
+			/* pulling the disk ends whatever it was doing - the light in the old bay owes that spell nothing */
+			x = random() % sim.disks;
+			sim.hdd[x] = bays[random() % empty];
+			sim.busy[x] = sim.moved[x] = 0;
+			sim.quiet_since[x] = sim.now_ns;
+			sim.unshown[x] = -1;
+			sim.next_change[x] = sim.now_ns + (random() % 3000) * 1000000L;
+			++sim.moves;
+		}
+		else if(empty && random() % 2) {
+			x = sim.disks++;
+			sim.hdd[x] = bays[random() % empty];
+			sim.unshown[x] = -1;
+			sim.next_change[x] = sim.now_ns + (random() % 3000) * 1000000L;
+			++sim.adds;
+		}
+		return 1;
+	}
+
+	if(sim.now_ns == sim.last_snap && ++sim.violations <= 10)
+		printf("sequence %ld: snapshots back to back at %.1fms - a pass took no time\n", sim.seq, sim.now_ns / 1000000.0);
+	sim.last_snap = sim.now_ns;
+
+	sim_move();
+	return 0;
+};
+/* the counters of every disk that worked since they last moved */
+void sim_move(void)
+{
+	for(int x = 0; x < sim.disks; x++) {
+		if(!sim.moved[x] && !sim.busy[x])
+			continue;
+		sim.moved[x] = 0;
+
+		if(sim.kind[x] & 4 || sim.kind[x] == PURPLE) {
+			sim.rd[x] += 512 * (1 + random() % 256);
+			sim.pend[x] |= SIM_READ;
+		}
+		if(sim.kind[x] & 4 || sim.kind[x] == BLUE) {
+			sim.wr[x] += 512 * (1 + random() % 256);
+			sim.pend[x] |= SIM_WRITE;
+		}
+		sim.ops[x] += 1 + random() % 16;
+	}
+};
+int sim_counters(size_t di, u_int64_t *b_read, u_int64_t *b_write, u_int64_t *ops)
+{
+	if(((int)di == sim.sick && sim.now_ns < sim.faults_until) || sim_fault()) {
+		sim.fuzzy[di] = 1;
+		snprintf(devstat_errbuf, DEVSTAT_ERRBUF_SIZE, "simulated statistics fault on device %ld", di);
+		return -1;
+	}
+	*b_read = sim.rd[di];
+	*b_write = sim.wr[di];
+	*ops = sim.ops[di];
 	return 0;
 };
+/* simulated register - every write must change something, a light coming on must be the colour of what its disk did - blue
+   for writes, with or without reads, purple for reads alone - and it answers its disk's unshown spell */
+void sim_write(u_int16_t reg)
+{
+	const u_int16_t *row;
+	u_int16_t mask, on;
+	int want;
+
+	++sim.writes;
+
+	if(reg == sim.reg && ++sim.violations <= 10)
+		printf("sequence %ld: redundant register write %04x at %.1fms\n", sim.seq, reg, sim.now_ns / 1000000.0);
+
+	for(int x = 0; x < sim.disks; x++) {
+		row = led_mask[sim.hdd[x] & (LED_ROWS - 1)];
+		mask = row[PURPLE];
+		on = ~reg & mask;
+
+		/* the light came on, or came on in another colour */
+		if(on && on != (~sim.reg & mask)) {
+			want = (sim.pend[x] & SIM_WRITE) ? BLUE : PURPLE;
+			sim.colours += (sim.pend[x] && !sim.fuzzy[x]);
+			if(sim.pend[x] && !sim.fuzzy[x] && on != row[want] && ++sim.violations <= 10)
+				printf("sequence %ld: Slot %i lit %s at %.1fms after %s%s%s\n", sim.seq, sim.hdd[x],
+					on == row[BLUE] ? "blue" : on == row[PURPLE] ? "purple" : "red", sim.now_ns / 1000000.0,
+					(sim.pend[x] & SIM_READ) ? "reads" : "", sim.pend[x] == (SIM_READ | SIM_WRITE) ? " and " : "",
+					(sim.pend[x] & SIM_WRITE) ? "writes" : "");
+			sim.pend[x] = sim.fuzzy[x] = 0;
+		}
+
+		if((sim.reg & mask) != mask || (reg & mask) == mask || sim.unshown[x] < 0)
+			continue;
+		if(sim.now_ns - sim.unshown[x] > sim.worst_on)
+			sim.worst_on = sim.now_ns - sim.unshown[x];
+		sim.unshown[x] = -1;
+	}
+	sim.reg = reg;
+};
+u_int16_t sim_read(void)
+{
+	return sim.reg;
+};
+/* --simulate: run the real supervisor and monitor loop over randomized activity and devstat faults in simulated time and check
+   what the LEDs and the supervisor did. returns 1 on any violation */
+int simulate(size_t sequences)
+{
+	struct timespec start, end;
+	int64_t sim_total = 0, worst_on = 0, worst_lit = 0;
+	u_int64_t ticks = 0, writes = 0, colours = 0, violations = 0, backoffs = 0, reinits = 0, moves = 0, adds = 0;
+	size_t quarantined;
+	int bays[BAYS], b, t, x;
+	double wall;
+
+	clk = &sim_clock;
+	src = &sim_src;
+	sink = &sim_sink;
+	/* the supervisor's complaints about simulated faults are expected - keep them out of syslog */
+	setlogmask(LOG_MASK(LOG_EMERG));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for(size_t n = 1; n <= sequences; n++) {
+		/* each sequence is reproducible from its number */
+		srandom(n);
+		memset(&sim, 0, sizeof(sim));
+		memset(hpex470, 0, sizeof(hpex470));
+		sim.seq = n;
+		sim.reg = encreg = CTL;
+		sim.last_snap = -1;
+		failures = 0;
+
+		/* 1-4 disks in a random choice of bays, so the bay map is exercised as well as the lights */
+		for(b = 0; b < BAYS; b++)
+			bays[b] = b + 1;
+		for(b = BAYS - 1; b > 0; b--) {
+			t = random() % (b + 1);
+			x = bays[b];
+			bays[b] = bays[t];
+			bays[t] = x;
+		}
+		sim.disks = 1 + random() % BAYS;
+		for(x = 0; x < sim.disks; x++) {
+			sim.hdd[x] = bays[x];
+			sim.unshown[x] = -1;
+			sim.next_change[x] = (random() % 3000) * 1000000L;
+		}
+
+		/* every other sequence starts with up to 4 minutes of devstat faults - from the odd failure to an outage, sometimes with a
+		   disk that can't be read at all. then it runs long enough for a stale device list to be re-read and any backoff and
+		   quarantine to run out */
+		sim.sick = -1;
+		if(n % 2 == 0) {
+			sim.fault_rate = 1 + random() % 30;
+			sim.faults_until = (5000 + random() % 235000) * 1000000L;
+			if(random() % 2)
+				sim.sick = random() % sim.disks;
+			sim.settled = sim.faults_until + (2 * BACKOFF_MAX * 1000L + QUARANTINE_MAX + 5000) * 1000000L;
+		}
+		sim_advance(0);
+		sample_end = sim.settled / 1000000 + 5000 + random() % 55000;
+
+		/* start like the daemon - the first init places the disks, later ones place them again wherever they are by then */
+		global_count = src->init();
+		supervise(1);
+		supervise(0);
+
+		/* the faults are long over - every disk must be back in its bay and out of quarantine. a device change on the last
+		   snapshot may leave the supervisor about to re-initialize, which is fine */
+		quarantined = 0;
+		for(x = 0; x < global_count; x++)
+			quarantined += (hpex470[x].q_delay != 0);
+		if((hp_state == HP_BACKOFF || global_count != sim.disks || failures || quarantined) && ++sim.violations <= 10)
+			printf("sequence %ld: not recovered at the end - %ld of %d disks placed, %ld quarantined, %ld failures in a row\n",
+				sim.seq, global_count, sim.disks, quarantined, failures);
+
+		sim_total += sim.now_ns;
+		ticks += sim.ticks;
+		writes += sim.writes;
+		colours += sim.colours;
+		violations += sim.violations;
+		backoffs += sim.backoffs;
+		reinits += sim.reinits;
+		moves += sim.moves;
+		adds += sim.adds;
+		worst_on = MAX(worst_on, sim.worst_on);
+		worst_lit = MAX(worst_lit, sim.worst_lit);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	if(wall <= 0)
+		wall = 1e-9;
+
+	printf("%ld sequences, %.0f simulated seconds, %ju ticks in %.3fs - %.0f ticks/s\n",
+		sequences, sim_total / 1e9, (uintmax_t)ticks, wall, ticks / wall);
+	printf("supervisor: %ju snapshot failures, %ju init failures, %ju backoffs, %ju device changes (%ju disks moved bay, %ju added), "
+		"%ju quarantines, %ju recoveries\n", (uintmax_t)stats.snapshot_errors, (uintmax_t)stats.init_errors, (uintmax_t)backoffs,
+		(uintmax_t)reinits, (uintmax_t)moves, (uintmax_t)adds, (uintmax_t)stats.quarantines, (uintmax_t)stats.recoveries);
+	printf("%ju register writes, %ju light colours checked, work to light on at most %.1fms (limit %dms), quiet to light off at most %.1fms "
+		"(limit %dms), %ju violations\n", (uintmax_t)writes, (uintmax_t)colours, worst_on / 1e6, SIM_MAX_ON, worst_lit / 1e6, SIM_MAX_LIT,
+		(uintmax_t)violations);
+
+	return (violations != 0);
+};
+#endif
+/* SIGUSR1/SIGINFO - ask the monitor loop to log the stats */
+void stats_handler(int s)
+{
+	dump_stats = 1;
+};
+/* SIGCHLD - the LED writer or the CAM locator exited. it is reaped from chan_flush() on the next sleep */
+void chld_handler(int s)
+{
+	child_exited = 1;
+};
+/* all bay lights off - used before re-initializing and while backing off so nothing is left lit */
+void leds_off(void)
+{
+	if(encreg != CTL)
+		led_set(CTL);
+	for(int x = 0; x < BAYS; x++)
+		hpex470[x].led_state = 0;
+};
+/* fork a helper - the LED writer or the CAM locator - on a socketpair. returns our end of the channel, the helper's pid in *pid */
+int helper_start(void (*helper)(int fd), pid_t *pid)
+{
+	int sv[2];
+
+	/* seqpacket keeps each message whole and tells the helper when we are gone */
+	if(socketpair(PF_LOCAL, SOCK_SEQPACKET, 0, sv) < 0)
+		err(1, "socketpair failed in %s line %d", __FUNCTION__, __LINE__);
+
+	if((*pid = fork()) < 0)
+		err(1, "fork failed in %s line %d", __FUNCTION__, __LINE__);
+
+	if(*pid == 0) {
+		/* the monitor's signal handlers and the other helper's channel are not ours - we stop when the monitor closes the channel */
+		signal(SIGTERM, SIG_IGN);
+		signal(SIGINT, SIG_IGN);
+		signal(SIGQUIT, SIG_IGN);
+		signal(SIGUSR1, SIG_IGN);
+		signal(SIGCHLD, SIG_DFL);
+#ifdef SIGINFO
+		signal(SIGINFO, SIG_IGN);
+#endif
+		if(led_chan >= 0)
+			close(led_chan);
+		close(sv[0]);
+		helper(sv[1]);
+		_exit(0);
+	}
+
+	close(sv[1]);
+	return sv[0];
+};
+/* the LED writer. opens /dev/io, gives up everything else, then puts each register image it is sent on the port */
+void led_helper(int fd)
+{
+	u_int16_t reg, next;
+	ssize_t len;
+#ifdef HAVE_CAPSICUM
+	cap_rights_t rights;
+#endif
+
+#ifdef __FreeBSD__
+	setproctitle("LED writer");
+#endif
+
+	/* I/O privilege comes with the open /dev/io and stays with this process - the uid is not needed after this */
+	if((io = open("/dev/io", 000)) < 0) {
+		syslog(LOG_ERR, "LED writer unable to open /dev/io - %m");
+		_exit(1);
+	}
+	port_write(CTL);
+
+	drop_priviledges();
+
+	/* main() won't run without us - tell it we have the port */
+	if(send(fd, "", 1, 0) != 1)
+		_exit(1);
+
+#ifdef HAVE_CAPSICUM
+	cap_rights_init(&rights, CAP_READ, CAP_EVENT);
+	if(cap_rights_limit(fd, &rights) < 0 && errno != ENOSYS)
+		syslog(LOG_WARNING, "LED writer unable to limit its channel - %m");
+	if(cap_enter() < 0 && errno != ENOSYS)
+		syslog(LOG_WARNING, "LED writer unable to enter capability mode - %m");
+#endif
+	syslog(LOG_NOTICE, "LED writer ready");
+
+	while(1) {
+		len = recv(fd, &reg, sizeof(reg), 0);
+
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len != sizeof(reg))
+			break;
+
+		/* if we fell behind only the newest image matters */
+		while(recv(fd, &next, sizeof(next), MSG_DONTWAIT) == sizeof(next))
+			reg = next;
+
+		port_write(reg);
+	}
+
+	/* the monitor is gone - leave the bays dark rather than frozen */
+	port_write(CTL);
+	close(io);
+	_exit(0);
+};
+/* the CAM locator. the only process that keeps root after startup, and all it does with it is answer where a disk sits -
+   for names that look like a disk. no capability mode: CAM opens /dev/xpt0 and the pass device by path for every question */
+void cam_helper(int fd)
+{
+	struct camreply reply;
+	char name[32];
+	ssize_t len;
+	size_t n;
+
+#ifdef __FreeBSD__
+	setproctitle("CAM locator");
+#endif
+
+	while(1) {
+		len = recv(fd, name, sizeof(name), 0);
+
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			break;
+
+		memset(&reply, 0, sizeof(reply));
+		/* /dev/ then letters then digits, nothing else */
+		n = 0;
+		if(name[len - 1] == '\0' && strncmp(name, "/dev/", 5) == 0)
+			n = strspn(name + 5, "abcdefghijklmnopqrstuvwxyz");
+		if(n == 0 || name[5 + n] == '\0' || name[5 + n + strspn(name + 5 + n, "0123456789")] != '\0') {
+			reply.rc = -1;
+			strlcpy(reply.errbuf, "not a disk device name", sizeof(reply.errbuf));
+		}
+		else if((reply.rc = cam_lookup(name, &reply.path_id, &reply.target_id)) != 0)
+			strlcpy(reply.errbuf, cam_errbuf, sizeof(reply.errbuf));
+
+		if(send(fd, &reply, sizeof(reply), 0) != sizeof(reply))
+			break;
+	}
+	_exit(0);
+};
+/* collect any helper that has exited, log how it went and stop talking to it. a no-op while they are still running */
+void helpers_reap(void)
+{
+	int status;
+	pid_t pid;
+
+	child_exited = 0;
+	while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		if(pid == led_pid) {
+			led_pid = -1;
+			if(WIFSIGNALED(status))
+				syslog(LOG_ERR, "LED writer killed by signal %d. Monitoring continues without lights", WTERMSIG(status));
+			else
+				syslog(LOG_ERR, "LED writer exited with status %d. Monitoring continues without lights", WEXITSTATUS(status));
+			if(led_chan >= 0) {
+				close(led_chan);
+				led_chan = -1;
+			}
+		}
+		else if(pid == cam_pid) {
+			cam_pid = -1;
+			if(WIFSIGNALED(status))
+				syslog(LOG_ERR, "CAM locator killed by signal %d. New disks can't be placed until a restart", WTERMSIG(status));
+			else
+				syslog(LOG_ERR, "CAM locator exited with status %d. New disks can't be placed until a restart", WEXITSTATUS(status));
+			if(cam_chan >= 0) {
+				close(cam_chan);
+				cam_chan = -1;
+			}
+		}
+	}
+};
+/* limit what the monitor's descriptors can be used for. no cap_enter() here - every snapshot reads the kern.devstat sysctls,
+   which are not CTLFLAG_CAPRD, so in capability mode devstat_getdevs() would fail with ECAPMODE and we would back off forever */
+void sandbox_fds(void)
+{
+#ifdef HAVE_CAPSICUM
+	cap_rights_t rights;
+
+	if(led_chan >= 0 && cap_rights_limit(led_chan, cap_rights_init(&rights, CAP_WRITE)) < 0 && errno != ENOSYS)
+		syslog(LOG_WARNING, "Unable to limit the LED writer channel - %m");
+	if(cam_chan >= 0 && cap_rights_limit(cam_chan, cap_rights_init(&rights, CAP_READ, CAP_WRITE)) < 0 && errno != ENOSYS)
+		syslog(LOG_WARNING, "Unable to limit the CAM locator channel - %m");
+	if(devd >= 0 && cap_rights_limit(devd, cap_rights_init(&rights, CAP_READ, CAP_EVENT)) < 0 && errno != ENOSYS)
+		syslog(LOG_WARNING, "Unable to limit the devd socket - %m");
+	/* accepted --status connections inherit these, so the listener needs CAP_WRITE for the reply */
+	if(status_fd >= 0 && cap_rights_limit(status_fd, cap_rights_init(&rights, CAP_ACCEPT, CAP_EVENT, CAP_WRITE)) < 0 && errno != ENOSYS)
+		syslog(LOG_WARNING, "Unable to limit the status socket - %m");
+#endif
+};
 /* attempt to drop privileges after initialization */
 void drop_priviledges(void) {
 	struct passwd* pw = getpwnam( "nobody" );
 	if ( !pw ) return; /* huh? */
-	if ( (setgid( pw->pw_gid )) && (setuid( pw->pw_uid )) != 0 )
-		err(1, "Unable to set gid or uid to nobody in %s line %d", __FUNCTION__, __LINE__);
+	/* groups first - once the uid is gone we can't change them. any one of these failing leaves us privileged */
+	if ( setgroups( 1, &pw->pw_gid ) != 0 || setgid( pw->pw_gid ) != 0 || setuid( pw->pw_uid ) != 0 )
+		err(1, "Unable to set groups, gid or uid to nobody in %s line %d", __FUNCTION__, __LINE__);
 
 	if(debug) {
 		printf("Successfully dropped priviledges to %s \n",pw->pw_name);
@@ -654,6 +2082,12 @@ int show_help(char * progname ) {
 	printf("-a  --audit     Print LED status info in syslog -- diagnostic purposes\n");
 	printf("-d, --debug 	Print Debug Messages -- VERBOSE!\n");
 	printf("-D, --daemon 	Detach and Run as a Daemon - do not use this in service setup \n");
+	printf("-F, --fault N	Fail roughly 1 in N devstat calls -- testing error recovery only\n");
+	printf("-S, --sample N	Monitor for N seconds and print rates and LED decisions without touching the LEDs - no root needed\n");
+	printf("-s, --status	Print the bay map, rates and LED state from the running daemon\n");
+#ifdef HPEX_SIMULATE
+	printf("-t, --simulate N	Check the LED logic against N randomized activity sequences in simulated time\n");
+#endif
 	printf("-h, --help	Print This Message\n");
 	printf("-v, --version	Print Version Information\n");
 
@@ -668,25 +2102,28 @@ int show_version(char * progname ) {
 
 int main (int argc, char **argv)
 {
-   
-	if (geteuid() !=0 ) {
-		printf("Must be run as root\n");
-		err(1, "not running as root user");
-	}
 
         // long command line arguments
         const struct option long_opts[] = {
 				{ "audit",			no_argument,	   0, 'a' },
                 { "debug",          no_argument,       0, 'd' },
                 { "daemon",         no_argument,       0, 'D' },
+                { "fault",          required_argument, 0, 'F' },
+                { "sample",         required_argument, 0, 'S' },
+                { "status",         no_argument,       0, 's' },
+#ifdef HPEX_SIMULATE
+                { "simulate",       required_argument, 0, 't' },
+#endif
                 { "help",           no_argument,       0, 'h' },
                 { "version",        no_argument,       0, 'v' },
                 { 0, 0, 0, 0 },
         };
+	char ready;
+	ssize_t len;
 
         // pass command line arguments
         while ( 1 ) {
-                const int c = getopt_long( argc, argv, "adDhv?", long_opts, 0 );
+                const int c = getopt_long( argc, argv, "adDF:S:s" SIM_OPT "hv?", long_opts, 0 );
                 if ( -1 == c ) break;
 
                 switch ( c ) {
@@ -696,6 +2133,25 @@ int main (int argc, char **argv)
 				case 'D': // daemon
 						++run_as_daemon;
 						break;
+				case 'F': // fault injection
+						fault_rate = strtoul(optarg, NULL, 10);
+						if(fault_rate == 0)
+							return show_help(argv[0]);
+						break;
+				case 'S': // sample
+						sample_secs = strtoul(optarg, NULL, 10);
+						if(sample_secs == 0)
+							return show_help(argv[0]);
+						break;
+				case 's': // status
+						return show_status();
+#ifdef HPEX_SIMULATE
+				case 't': // simulate
+						sim_sequences = strtoul(optarg, NULL, 10);
+						if(sim_sequences == 0)
+							return show_help(argv[0]);
+						break;
+#endif
                 case 'd': // debug
                         ++debug;
                         break;
@@ -711,85 +2167,115 @@ int main (int argc, char **argv)
         }
 	progname = curdir(argv[0]);
 
+	if(fault_rate) {
+		srandom(time(NULL) ^ getpid());
+		src = &fault_src;
+	}
+
+#ifdef HPEX_SIMULATE
+	if(sim_sequences)
+		return simulate(sim_sequences);
+#endif
+
+	if(sample_secs) {
+		openlog("hpex47xled:", LOG_PERROR, LOG_USER );
+		return sample_run(sample_secs);
+	}
+
+	if (geteuid() !=0 ) {
+		printf("Must be run as root\n");
+		err(1, "not running as root user");
+	}
+
 	openlog("hpex47xled:", LOG_CONS | LOG_PID, LOG_DAEMON );
 	syslog( LOG_NOTICE, "Starting %s version %s",progname, VERSION );
 	signal( SIGTERM, sigterm_handler);
 	signal( SIGINT, sigterm_handler);
 	signal( SIGQUIT, sigterm_handler);
 	signal( SIGILL, sigterm_handler);
+	signal( SIGUSR1, stats_handler);
+	signal( SIGPIPE, SIG_IGN);
+	signal( SIGCHLD, chld_handler);
+#ifdef SIGINFO
+	signal( SIGINFO, stats_handler);
+#endif
 
 	if ( run_as_daemon ) {
 		if (daemon( 0, 0 ) > 0 )
 			err(1, "Unable to daemonize :");
 	  }
 
-	io = open("/dev/io", 000);
+	/* the LED writer owns /dev/io - this process never opens it and the writer starts with the lights off */
+	led_chan = helper_start(led_helper, &led_pid);
+	sink = &chan_sink;
 	encreg = CTL;
-	outw(ADDR, encreg); 
 
-	global_count = disk_init();
+	/* a light controller that can't reach the lights should fail to start, so rc.d sees it - not run on with one syslog line */
+	if(setsockopt(led_chan, SOL_SOCKET, SO_RCVTIMEO, &(struct timeval){ HELPER_TIMEOUT, 0 }, sizeof(struct timeval)) < 0)
+		err(1, "setsockopt failed in %s line %d", __FUNCTION__, __LINE__);
+	while((len = recv(led_chan, &ready, sizeof(ready), 0)) < 0 && errno == EINTR)
+		;
+	if(len != sizeof(ready)) {
+		syslog(LOG_ERR, "LED writer did not start - exiting");
+		errx(1, "LED writer did not start - see syslog");
+	}
+
+	/* the CAM locator keeps root so re-inits as nobody can still ask CAM where a disk sits */
+	cam_chan = helper_start(cam_helper, &cam_pid);
+	if(setsockopt(cam_chan, SOL_SOCKET, SO_RCVTIMEO, &(struct timeval){ HELPER_TIMEOUT, 0 }, sizeof(struct timeval)) < 0)
+		syslog(LOG_WARNING, "Unable to set a time out for the CAM locator - %m");
+
+	if(fault_rate)
+		syslog(LOG_WARNING, "Using %s - 1 in %ld calls will fail", src->name, fault_rate);
+
+	global_count = src->init();
 
 	if(debug) 
 		printf("The global count is %ld \n", global_count);
 
-	/* Try and drop root priviledges now that we have initialized */
-	drop_priviledges();
+	/* hotswap notification for idle mode and the --status socket - set up while still root */
+	devd = devd_connect();
+	status_fd = status_listen();
+	stats.started = time(NULL);
 
-	syslog(LOG_NOTICE,"Initialized. Now monitoring for drive activity");
+	/* the first placement asks CAM directly - if it found nothing, back off and retry before we drop */
+	supervise(1);
 
-	if(audit_mon)
-		syslog(LOG_NOTICE, "LED Auditing Enabled");
+	if(!stop_signal) {
+		/* Try and drop root priviledges now that we have initialized */
+		sandbox_fds();
+		drop_priviledges();
 
-	run = 1;
-	while(1) {
- 
-        switch (run) {
-            case 1: {
-                int retval = run_mediasmart();
-
-                switch(retval) {
-                    case -1:
-                        errx(1, "%s", devstat_errbuf);
-                        break;
-                    case 1:
-						free(cur.dinfo);
-						cur.dinfo = NULL;
-						free(dev_select);
-						free(matches);
-						syslog(LOG_NOTICE, "New or removed device detected - reinitializing");
-						if(debug)
-							fprintf(stderr, "\n\n**** New/Removed Device Detected - re-initializing ****\n\n");
-						global_count = disk_init();
-						if(global_count <= 0)
-							err(1, "Unknown return from disk initialization in %s line %d", __FUNCTION__, __LINE__);
-						run = 1;
-                        break;
-					default:
-						fprintf(stderr,"In default case in retval switch loop - function %s line %d\n", __FUNCTION__, __LINE__);
-						break;
-                }
-            }
-            default:
-				fprintf(stderr,"In default case in run switch - function %s line %d\n", __FUNCTION__, __LINE__);
-                break;
-        }
+		syslog(LOG_NOTICE,"Initialized. Now monitoring for drive activity");
+
+		if(audit_mon)
+			syslog(LOG_NOTICE, "LED Auditing Enabled");
+
+		supervise(0);
+	}
+
+	/* the LED writer sees the channel close and turns the lights off - before anything else, so they go dark whatever follows */
+	close(led_chan);
+
+	if(stop_signal) {
+		syslog(LOG_NOTICE,"Caught signal %d and closing down", (int)stop_signal);
+		log_stats();
+		closelog();
+		disk_fini();
+		errx(1, "Exiting from signal %d", (int)stop_signal);
+	}
 
-	}	
-	outw(ADDR, encreg);
-	close(io);
 	syslog(LOG_NOTICE,"Closing Down");
 	closelog();	
 	return(0);
 };
-/* signal handling and cleanup */
+/* SIGTERM/SIGINT/SIGQUIT - only note it. syslog, malloc and free aren't safe here, so main() shuts down once the loops unwind */
 void sigterm_handler(int s)
 {
-	outw(ADDR, encreg);
-	syslog(LOG_NOTICE,"Caught signal %d and closing down", s);
-	closelog();
-	close(io);
-	free(cur.dinfo);
-	free(dev_select);
-	free(matches);
-	err(1, "Exiting from signal");
+	/* SIGILL would come straight back if we returned - close the channel so the LED writer turns the lights off, and go */
+	if(s == SIGILL) {
+		close(led_chan);
+		_exit(1);
+	}
+	stop_signal = s;
 };